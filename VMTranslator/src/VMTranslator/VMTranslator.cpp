@@ -16,24 +16,395 @@
 #include <experimental/filesystem>
 
 
+// Options:
+
+/**
+ * Initializes the Options to the default level, -O1.
+ */
+Options::Options()
+{
+    this->sizeReport = false;
+    this->romWarnOnly = false;
+    this->stats = false;
+    this->emitIR = false;
+    this->directWrite = false;
+    this->instrument = 0;
+    this->profileBase = 0; // Decided by the Translator: The top of the heap, just under the screen.
+    this->sizeBaseline = "";
+    this->recordBaseline = false;
+    this->sizeTolerance = 2;
+    this->jobs = 0;
+    setLevel("1");
+    return;
+}
+
+/**
+ * Applies a command line option: -O0, -O1, -O2, -Os, -f<pass>, -fno-<pass>, --size-report, --rom-warn, --stats,
+ * --emit-ir, --direct-write, --instrument, --instrument-labels, --profile-base=<address>, --size-baseline=<path>, --record-baseline,
+ * --size-tolerance=<percent>, or --jobs=<count>.
+ * Pass toggles override the level wherever they are given, so -fno-vstack -O2 still leaves vstack off.
+ *
+ * @param arg The command line argument.
+ * @return 0 if arg is a valid option, 1 if not.
+ */
+int Options::parseArg(string arg)
+{
+    if (arg == "-O0" || arg == "-O1" || arg == "-O2" || arg == "-Os")
+    {
+        setLevel(arg.substr(2));
+        return 0;
+    }
+    else if (arg == "--size-report")
+    {
+        this->sizeReport = true;
+        return 0;
+    }
+    else if (arg == "--rom-warn")
+    {
+        this->romWarnOnly = true;
+        return 0;
+    }
+    else if (arg == "--stats")
+    {
+        this->stats = true;
+        return 0;
+    }
+    else if (arg == "--emit-ir")
+    {
+        this->emitIR = true;
+        return 0;
+    }
+    else if (arg == "--direct-write")
+    {
+        this->directWrite = true;
+        return 0;
+    }
+    else if (arg == "--instrument" || arg == "--instrument-labels")
+    {
+        this->instrument = std::max(this->instrument, (arg == "--instrument") ? 1 : 2);
+        return 0;
+    }
+    else if (arg.substr(0, 15) == "--profile-base=")
+    {
+        string address = arg.substr(15);
+        if (address.empty() || address.find_first_not_of("0123456789") != string::npos || address.length() > 5)
+            return 1;
+        this->profileBase = std::stoi(address);
+        return (this->profileBase < Translator::HEAP_BASE || this->profileBase >= Translator::SCREEN_BASE) ? 1 : 0; // Only the heap has room to spare.
+    }
+    else if (arg.substr(0, 16) == "--size-baseline=" && arg.length() > 16)
+    {
+        this->sizeBaseline = arg.substr(16);
+        return 0;
+    }
+    else if (arg == "--record-baseline")
+    {
+        this->recordBaseline = true;
+        return 0;
+    }
+    else if (arg.substr(0, 17) == "--size-tolerance=")
+    {
+        string percent = arg.substr(17);
+        if (percent.empty() || percent.find_first_not_of("0123456789") != string::npos || percent.length() > 4)
+            return 1;
+        this->sizeTolerance = std::stoi(percent);
+        return 0;
+    }
+    else if (arg.substr(0, 7) == "--jobs=")
+    {
+        string count = arg.substr(7);
+        if (count.empty() || count.find_first_not_of("0123456789") != string::npos || count.length() > 3)
+            return 1;
+        this->jobs = std::stoi(count);
+        return 0;
+    }
+    
+    if (arg.substr(0, 2) != "-f")
+        return 1;
+    
+    bool enable = true;
+    string pass = arg.substr(2);
+    if (pass.substr(0, 3) == "no-")
+    {
+        enable = false;
+        pass = pass.substr(3);
+    }
+    
+    if (this->enabled.find(pass) == this->enabled.end()) // Not a known pass.
+        return 1;
+    
+    this->toggles[pass] = enable;
+    this->enabled[pass] = enable;
+    return 0;
+}
+
+/**
+ * Sets the optimization level, enabling every pass that level includes and disabling the rest.
+ * Pass toggles given so far are then applied on top.
+ * -O0 is the plain translation, -O1 the safe optimizations, -O2 all of them, -Os all of them with a size goal.
+ *
+ * @param level The level as "0", "1", "2", or "s".
+ */
+void Options::setLevel(string level)
+{
+    this->level = level;
+    int levelNum = (level == "s") ? 2 : std::stoi(level);
+    
+    for (int i = 0; i < this->PASSES.size(); i++)
+        this->enabled[this->PASSES.at(i).at(0)] = std::stoi(this->PASSES.at(i).at(1)) <= levelNum;
+    
+    for (map<string, bool>::iterator it = this->toggles.begin(); it != this->toggles.end(); it++)
+        this->enabled[it->first] = it->second;
+    
+    return;
+}
+
+/**
+ * Checks if a pass should run.
+ *
+ * @param pass The name of the pass, as found in PASSES.
+ * @return True if the pass is enabled.
+ */
+bool Options::isEnabled(string pass)
+{
+    map<string, bool>::iterator it = this->enabled.find(pass);
+    return it != this->enabled.end() && it->second;
+}
+
+/**
+ * Checks the goal used when there is a choice of asm sequences for the same vm code.
+ *
+ * @return True to prefer the fewest asm lines, false to prefer the fewest executed instructions.
+ */
+bool Options::isOptimizeForSize()
+{
+    return this->level == "s";
+}
+
+/**
+ * Checks if a .size report should be written next to the .asm output.
+ *
+ * @return True if the report was asked for.
+ */
+bool Options::isSizeReport()
+{
+    return this->sizeReport;
+}
+
+/**
+ * Checks if output that doesn't fit in ROM is only a warning.
+ *
+ * @return True to warn, false to fail.
+ */
+bool Options::isROMWarnOnly()
+{
+    return this->romWarnOnly;
+}
+
+/**
+ * Checks if the changes made by the optimization passes should be printed.
+ *
+ * @return True if --stats was given.
+ */
+bool Options::isStats()
+{
+    return this->stats;
+}
+
+/**
+ * Checks if the parsed commands of each .vm file should be written to a .vmir file.
+ *
+ * @return True if --emit-ir was given.
+ */
+bool Options::isEmitIR()
+{
+    return this->emitIR;
+}
+
+/**
+ * Checks if the output should be written on the translating thread, instead of overlapping with translation.
+ *
+ * @return True if --direct-write was given.
+ */
+bool Options::isDirectWrite()
+{
+    return this->directWrite;
+}
+
+/**
+ * Gets which profiling counters to add to the output.
+ *
+ * @return 0 for none, 1 for function entries, 2 for function entries and labels.
+ */
+int Options::getInstrument()
+{
+    return this->instrument;
+}
+
+/**
+ * Gets the RAM address of the first profiling counter. The counters take up the registers after it.
+ *
+ * @return The address, or 0 to end the counters right under the screen.
+ */
+int Options::getProfileBase()
+{
+    return this->profileBase;
+}
+
+/**
+ * Gets the path of the size baseline file.
+ *
+ * @return The path, or "" if no baseline should be recorded or compared against.
+ */
+string Options::getSizeBaseline()
+{
+    return this->sizeBaseline;
+}
+
+/**
+ * Checks if the size baseline file should be (re)written with the current sizes, instead of compared against.
+ *
+ * @return True if it should be recorded.
+ */
+bool Options::isRecordBaseline()
+{
+    return this->recordBaseline;
+}
+
+/**
+ * Gets how much the asm line counts may grow past the size baseline before it is a regression.
+ *
+ * @return The tolerance in percent.
+ */
+int Options::getSizeTolerance()
+{
+    return this->sizeTolerance;
+}
+
+/**
+ * Gets how many threads to parse with.
+ *
+ * @return The thread count, at least 1.
+ */
+int Options::getJobs()
+{
+    if (this->jobs > 0)
+        return this->jobs;
+    
+    int hardwareThreads = std::thread::hardware_concurrency(); // 0 if it can't be told.
+    return std::max(hardwareThreads, 1);
+}
+
+/**
+ * Describes the options, to be recorded in the output.
+ * I.E. "-O1 goal=speed passes: frames locals"
+ *
+ * @return The description as a string.
+ */
+string Options::getDescription()
+{
+    string output = "-O" + this->level + " goal=" + (isOptimizeForSize() ? "size" : "speed") + " passes:";
+    
+    for (int i = 0; i < this->PASSES.size(); i++)
+    {
+        if (isEnabled(this->PASSES.at(i).at(0)))
+            output += " " + this->PASSES.at(i).at(0);
+    }
+    
+    if (this->instrument > 0)
+        output += string(" instrument=") + (this->instrument == 1 ? "functions" : "labels") + " profile-base=" + (this->profileBase == 0 ? string("top") : std::to_string(this->profileBase));
+    
+    return output;
+}
+
 // Parser: 
 Parser::Parser(){}
 
 /**
  * Parses the vm code.
  * Stores the result in this->output.
+ * Input of at least 2 * MIN_CHUNK_SIZE chars is split into up to jobs chunks, which are resolved and parsed
+ * on their own threads. Chunks are joined in input order, so the result is the same as parsing it in one go.
  * 
- * @param input Unprocessed VM code as string pointer.
+ * @param input Unprocessed VM code as string pointer. It is replaced with the resolved code.
+ * @param jobs The most threads to parse with.
  */
-void Parser::parseInput(string* input)
+void Parser::parseInput(string* input, int jobs)
 {
-    *input = resolveExcess(input); // Find and remove all white space, excess newlines, and comments.
+    int chunks = std::min(jobs, (int)(input->length() / this->MIN_CHUNK_SIZE));
+    vector<int> starts = getChunkStarts(input, chunks);
+    
+    if (starts.size() <= 1)
+    {
+        *input = resolveExcess(input); // Find and remove all white space, excess newlines, and comments.
+        
+        output = parseVMString(*input); // Parse the VM commands into a 2D vector<string>.
+        
+        return;
+    }
+    
+    // Each chunk is whole lines, so resolving and parsing it doesn't depend on the chunks around it:
+    vector<string> resolved(starts.size());
+    vector<vector<vector<string>>> results(starts.size());
+    vector<std::thread> threads;
+    for (int i = 0; i < starts.size(); i++)
+    {
+        int end = (i + 1 < starts.size()) ? starts.at(i + 1) : input->length() - 1; // The last chunk stops at '\0'.
+        threads.push_back(std::thread([this, input, i, end, &starts, &resolved, &results]()
+        {
+            string chunk = input->substr(starts.at(i), end - starts.at(i));
+            chunk.append(1, '\0');
+            resolved.at(i) = resolveExcess(&chunk);
+            results.at(i) = parseVMString(resolved.at(i));
+        }));
+    }
     
-    output = parseVMString(*input); // Parse the VM commands into a 2D vector<string>.
+    string resolvedInput = "";
+    output.clear();
+    for (int i = 0; i < threads.size(); i++)
+    {
+        threads.at(i).join();
+        resolvedInput.append(resolved.at(i), 0, resolved.at(i).length() - 1); // Without the chunk's '\0'.
+        output.insert(output.end(), results.at(i).begin(), results.at(i).end());
+    }
+    resolvedInput.append(1, '\0');
+    *input = resolvedInput;
     
     return;
 }
 
+/**
+ * Finds where to split input into chunks of about the same size.
+ * Chunks start at a function command where there is one, so each function is parsed whole, or else at a new line.
+ *
+ * @param input Unprocessed VM code as string pointer, '\0' terminated.
+ * @param chunks How many chunks to split into.
+ * @return The index in input that each chunk starts at, in order. Just {0} for a single chunk.
+ */
+vector<int> Parser::getChunkStarts(string* input, int chunks)
+{
+    vector<int> starts = {0};
+    int length = input->length() - 1; // Without '\0'.
+    
+    for (int i = 1; i < chunks; i++)
+    {
+        size_t target = (size_t)length * i / chunks;
+        if (target <= starts.back())
+            continue;
+        
+        size_t start = input->find("\nfunction ", target - 1);
+        if (start == string::npos || start + 1 >= (size_t)length * (i + 1) / chunks) // No function before the next chunk.
+            start = input->find('\n', target - 1);
+        if (start == string::npos || start + 1 >= length)
+            break;
+        
+        if (start + 1 > starts.back())
+            starts.push_back(start + 1);
+    }
+    
+    return starts;
+}
+
 /**
  * Gets the string* output.
  * 
@@ -143,416 +514,2479 @@ vector<vector<string>> Parser::parseVMString(string input)
     return result;
 }
 
-// Translator: 
+// Optimizer:
 
 /**
- * Initializes values for the Translator.
+ * Initializes values for the Optimizer.
  */
-Translator::Translator()
+Optimizer::Optimizer(){}
+
+/**
+ * Runs every enabled optimization pass over the parsed vm program, in place.
+ *
+ * @param input A pointer to the 2D string vector that is the parsed input. It MUST have been parsed with Parser.
+ * @param options The code generation options, saying which passes are enabled.
+ */
+void Optimizer::optimizeInput(vector<vector<string>>* input, Options* options)
 {
-    this->output = "";
-    this->fileName = fileName;
-    this->asmLineNum = 0;
-    //this->curStaticNum = 0;
-    
-    initializePremadeASM();
+    if (options->isEnabled("strength"))
+        reduceMultiplyDivide(input, options->isOptimizeForSize());
+    if (options->isEnabled("arrays"))
+        recognizeArrayAccess(input);
+    if (options->isEnabled("jumps"))
+        cleanUpControlFlow(input);
+    if (options->isEnabled("fold"))
+        foldIdenticalFunctions(input);
     
     return;
 }
 
 /**
- * Creates a string that is a comment version of vm's command.
+ * Replaces calls to Math.multiply and Math.divide that have a constant operand pushed right before the call.
+ * Hack has no multiply instruction, so the call costs a full frame plus a software loop.
+ *  - Both operands constant: The result is pushed as a constant.
+ *  - push constant c; call Math.multiply 2 (or push constant c; push <x>; call Math.multiply 2): mulconst c,
+ *    an inline shift-and-add.
+ *  - push constant c; call Math.divide 2 with c a power of 2: divconst c, an inline bit by bit shift (a loop of it for small c).
+ * Inline code is only used if it is no larger than MAX_INLINE_SPEED (MAX_INLINE_SIZE when optimizing for size).
+ * This assumes Math.multiply and Math.divide are the OS functions: x * y and x / y (rounded toward 0) in 16 bits.
  *
- * @param vm The vector<string> that contains the vm command.
- * @return The comment as a string.
+ * @param input A pointer to the 2D string vector that is the parsed input.
+ * @param isOptimizeForSize True to use the smaller inline size limit.
  */
-string Translator::createVMComment(vector<string> vm)
+void Optimizer::reduceMultiplyDivide(vector<vector<string>>* input, bool isOptimizeForSize)
 {
-    string output = "// ";
+    int maxSize = isOptimizeForSize ? this->MAX_INLINE_SIZE : this->MAX_INLINE_SPEED;
+    vector<vector<string>> output;
     
-    for (int i = 0; i < vm.size(); i++)
+    for (int i = 0; i < input->size(); i++)
     {
-        output += vm.at(i) + " ";
+        vector<string> curCom = input->at(i);
+        bool isMultiply = (curCom.size() > 2 && curCom.at(0) == "call" && curCom.at(1) == "Math.multiply" && curCom.at(2) == "2");
+        bool isDivide = (curCom.size() > 2 && curCom.at(0) == "call" && curCom.at(1) == "Math.divide" && curCom.at(2) == "2");
+        int size = output.size();
+        if ((!isMultiply && !isDivide) || size < 2)
+        {
+            output.push_back(curCom);
+            continue;
+        }
+        
+        vector<string> x = output.at(size - 2);
+        vector<string> y = output.at(size - 1);
+        bool isXConst = (x.at(0) == "push" && x.at(1) == "constant");
+        bool isYConst = (y.at(0) == "push" && y.at(1) == "constant");
+        bool isYPush = (y.at(0) == "push");
+        
+        if (isXConst && isYConst && (isMultiply || std::stoi(y.at(2)) != 0)) // Fold it.
+        {
+            int a = std::stoi(x.at(2));
+            int b = std::stoi(y.at(2));
+            output.pop_back();
+            output.pop_back();
+            vector<vector<string>> result = getConstantPush(isMultiply ? (short)(a * b) : a / b);
+            output.insert(output.end(), result.begin(), result.end());
+            this->stats[isMultiply ? "multiplies folded" : "divides folded"]++;
+            continue;
+        }
+        
+        if (isMultiply && !isYConst && isXConst && isYPush) // x * y == y * x, so a constant first operand works too.
+        {
+            std::swap(x, y);
+            output.at(size - 2) = x;
+            output.at(size - 1) = y;
+            isYConst = true;
+        }
+        
+        int value = isYConst ? std::stoi(y.at(2)) : 0;
+        bool isPowerOf2 = value > 0 && (value & (value - 1)) == 0;
+        if (!isYConst || (isDivide && !isPowerOf2))
+        {
+            output.push_back(curCom);
+            continue;
+        }
+        
+        int inlineSize = isMultiply ? Translator::getConstMultiplySize(value) : Translator::getConstDivideSize(value, isOptimizeForSize);
+        if (inlineSize > maxSize)
+        {
+            output.push_back(curCom);
+            continue;
+        }
+        
+        output.pop_back(); // The push constant.
+        if (isMultiply)
+            output.push_back({"mulconst", std::to_string(value)});
+        else
+            output.push_back({"divconst", std::to_string(value)});
+        this->stats[isMultiply ? "multiplies inlined" : "divides inlined"]++;
     }
     
-    return output + ":\n";
+    *input = output;
+    
+    return;
 }
 
- /**
-  * Translate a parsed vm command as a vector<string>.
-  *
-  * @param vm vector<string> of a vm command, being parsed by Parser.
-  */
- void Translator::translateVMCom(vector<string> vm)
- {
-    if (vm.at(0) == "push" || vm.at(0) == "pop") // If it's a push/pop command:
-    {
-        translatePopPush(vm);
-    }
-    else if (vm.at(0) == "label")
+/**
+ * Gets vm code that pushes any 16 bit value, since push constant only takes 0 to 32767.
+ *
+ * @param value The value to push.
+ * @return The vm commands.
+ */
+vector<vector<string>> Optimizer::getConstantPush(int value)
+{
+    if (value >= 0)
+        return {{"push", "constant", std::to_string(value)}};
+    if (value == -32768)
+        return {{"push", "constant", "32767"}, {"neg"}, {"push", "constant", "1"}, {"sub"}};
+    return {{"push", "constant", std::to_string(-value)}, {"neg"}};
+}
+
+/**
+ * Replaces the array access code the Jack compiler makes for a[i] with the arrayload and arraystore pseudo commands,
+ * so the address is computed once and used right away, instead of going through the stack, pointer 1, and temp 0.
+ *  - add; pop pointer 1; push that 0 : arrayload.
+ *  - pop temp 0; pop pointer 1; push temp 0; pop that 0 : arraystore.
+ * that and temp 0 are still set, so code after the access sees the same registers.
+ *
+ * @param input A pointer to the 2D string vector that is the parsed input.
+ */
+void Optimizer::recognizeArrayAccess(vector<vector<string>>* input)
+{
+    const vector<vector<string>> LOAD = {{"add"}, {"pop", "pointer", "1"}, {"push", "that", "0"}};
+    const vector<vector<string>> STORE = {{"pop", "temp", "0"}, {"pop", "pointer", "1"}, {"push", "temp", "0"}, {"pop", "that", "0"}};
+    vector<vector<string>> output;
+    
+    for (int i = 0; i < input->size(); i++)
     {
-        translateLabel(vm.at(1), false);
+        if (i + LOAD.size() <= input->size() && std::equal(LOAD.begin(), LOAD.end(), input->begin() + i))
+        {
+            output.push_back({"arrayload"});
+            this->stats["array loads"]++;
+            i += LOAD.size() - 1;
+        }
+        else if (i + STORE.size() <= input->size() && std::equal(STORE.begin(), STORE.end(), input->begin() + i))
+        {
+            output.push_back({"arraystore"});
+            this->stats["array stores"]++;
+            i += STORE.size() - 1;
+        }
+        else
+            output.push_back(input->at(i));
     }
-    else if (vm.at(0).find("goto") != string::npos) // If the command is a goto or if-goto:
+    
+    *input = output;
+    
+    return;
+}
+
+/**
+ * Cleans up the control flow of every function (and of the code before the first function of each file), until nothing changes:
+ *  - Jumps to a label that is right before a goto go straight to where that goto goes.
+ *  - A goto to the next command is removed, and an if-goto to the next command only discards its condition.
+ *  - Commands no path from the start of the function reaches are removed.
+ *  - Labels no jump goes to are removed, so they don't end a basic block.
+ *
+ * @param input A pointer to the 2D string vector that is the parsed input.
+ */
+void Optimizer::cleanUpControlFlow(vector<vector<string>>* input)
+{
+    bool changed = true;
+    while (changed)
     {
-        translateGoTo(vm, false);
+        changed = false;
+        vector<vector<string>> output;
+        int start = 0;
+        for (int i = 1; i <= input->size(); i++)
+        {
+            // Labels are local to a function of a file, and anything may jump to a function:
+            string com = (i < input->size()) ? input->at(i).at(0) : "";
+            if (i < input->size() && com != "function" && com != "newfile" && com != "alias")
+                continue;
+            
+            vector<vector<string>> unit(input->begin() + start, input->begin() + i);
+            if (cleanUpUnit(&unit))
+                changed = true;
+            output.insert(output.end(), unit.begin(), unit.end());
+            start = i;
+        }
+        *input = output;
+    }
+    
+    return;
+}
+
+/**
+ * Does one round of cleanUpControlFlow's changes to a function.
+ *
+ * @param unit A pointer to the commands of the function. Only its first command can be jumped to from outside it.
+ * @return True if anything was changed.
+ */
+bool Optimizer::cleanUpUnit(vector<vector<string>>* unit)
+{
+    bool changed = false;
+    map<string, int> labels; // Where each label is.
+    for (int i = 0; i < unit->size(); i++)
+    {
+        if (unit->at(i).at(0) == "label")
+            labels[getLabelKey(unit->at(i).at(1))] = i;
+    }
+    
+    // Thread jumps through labels that are followed by a goto:
+    for (int i = 0; i < unit->size(); i++)
+    {
+        vector<string>* curCom = &unit->at(i);
+        if (curCom->at(0) != "goto" && curCom->at(0) != "if-goto")
+            continue;
+        
+        string target = curCom->at(1);
+        map<string, bool> seen = {{getLabelKey(target), true}}; // A loop of gotos never gets anywhere.
+        while (labels.find(getLabelKey(target)) != labels.end())
+        {
+            int next = labels[getLabelKey(target)];
+            while (next < unit->size() && unit->at(next).at(0) == "label")
+                next++;
+            if (next == unit->size() || unit->at(next).at(0) != "goto" || seen[getLabelKey(unit->at(next).at(1))])
+                break;
+            target = unit->at(next).at(1);
+            seen[getLabelKey(target)] = true;
+        }
+        
+        if (target != curCom->at(1))
+        {
+            curCom->at(1) = target;
+            this->stats["jumps threaded"]++;
+            changed = true;
+        }
+    }
+    
+    // Remove jumps to the next command. if-goto still has to pop its condition:
+    for (int i = 0; i < unit->size(); i++)
+    {
+        string com = unit->at(i).at(0);
+        if (com != "goto" && com != "if-goto")
+            continue;
+        
+        bool isToNext = false;
+        for (int j = i + 1; j < unit->size() && unit->at(j).at(0) == "label" && !isToNext; j++)
+            isToNext = getLabelKey(unit->at(j).at(1)) == getLabelKey(unit->at(i).at(1));
+        if (!isToNext)
+            continue;
+        
+        if (com == "goto")
+        {
+            unit->erase(unit->begin() + i);
+            i--;
+        }
+        else
+            unit->at(i) = {"discard"};
+        this->stats["jumps to the next command removed"]++;
+        changed = true;
+    }
+    
+    // Find every command reachable from the start, following jumps and falling through everything else:
+    labels.clear();
+    for (int i = 0; i < unit->size(); i++)
+    {
+        if (unit->at(i).at(0) == "label")
+            labels[getLabelKey(unit->at(i).at(1))] = i;
+    }
+    vector<bool> isReachable(unit->size(), false);
+    vector<int> starts = {0};
+    while (!starts.empty())
+    {
+        int i = starts.back();
+        starts.pop_back();
+        for (; i < unit->size() && !isReachable.at(i); i++)
+        {
+            isReachable.at(i) = true;
+            string com = unit->at(i).at(0);
+            if ((com == "goto" || com == "if-goto") && labels.find(getLabelKey(unit->at(i).at(1))) != labels.end())
+                starts.push_back(labels[getLabelKey(unit->at(i).at(1))]);
+            if (com == "goto" || com == "return")
+                break;
+        }
+    }
+    
+    // Remove unreachable commands, and labels nothing jumps to:
+    map<string, bool> targets;
+    for (int i = 0; i < unit->size(); i++)
+    {
+        string com = unit->at(i).at(0);
+        if (isReachable.at(i) && (com == "goto" || com == "if-goto"))
+            targets[getLabelKey(unit->at(i).at(1))] = true;
+    }
+    vector<vector<string>> output;
+    for (int i = 0; i < unit->size(); i++)
+    {
+        if (!isReachable.at(i))
+        {
+            this->stats["unreachable commands removed"]++;
+            changed = true;
+        }
+        else if (unit->at(i).at(0) == "label" && !targets[getLabelKey(unit->at(i).at(1))])
+        {
+            this->stats["unused labels removed"]++;
+            changed = true;
+        }
+        else
+            output.push_back(unit->at(i));
+    }
+    *unit = output;
+    
+    return changed;
+}
+
+/**
+ * Gets the name a label is known by. Label names are case insensitive, as the Translator makes them upper case.
+ *
+ * @param labelName The label name, as used in the vm code.
+ * @return The label name in upper case.
+ */
+string Optimizer::getLabelKey(string labelName)
+{
+    transform(labelName.begin(), labelName.end(), labelName.begin(), ::toupper);
+    return labelName;
+}
+
+/**
+ * Merges functions with identical bodies, I.E. trivial getters and setters of different classes.
+ * Only the first of each set of identical functions is kept. The others are removed, and declared
+ * with an "alias" pseudo command in front of the one that is kept, so their labels share its code.
+ * Functions are compared by normalizeFunction(), so label names and calls to themselves don't matter.
+ * A function that doesn't end with return or goto would run into the function after it, so it is never merged.
+ *
+ * @param input A pointer to the 2D string vector that is the parsed input.
+ */
+void Optimizer::foldIdenticalFunctions(vector<vector<string>>* input)
+{
+    map<string, string> bodies; // Normalized body -> the first function with it.
+    map<string, vector<string>> aliases; // Kept function -> the functions merged into it.
+    vector<bool> isRemoved(input->size(), false);
+    
+    string fileName = "";
+    for (int start = 0; start < input->size(); start++)
+    {
+        if (input->at(start).at(0) == "newfile")
+            fileName = input->at(start).at(1);
+        if (input->at(start).at(0) != "function")
+            continue;
+        
+        // The function goes until the next function or file:
+        int end = start + 1;
+        while (end < input->size() && input->at(end).at(0) != "function" && input->at(end).at(0) != "newfile")
+            end++;
+        
+        string lastCom = input->at(end - 1).at(0);
+        if (lastCom != "return" && lastCom != "goto")
+            continue;
+        
+        string funcName = input->at(start).at(1);
+        string body = normalizeFunction(input, start, end, fileName);
+        if (bodies.find(body) == bodies.end())
+        {
+            bodies[body] = funcName;
+            continue;
+        }
+        
+        aliases[bodies[body]].push_back(funcName);
+        this->foldedFunctions[funcName] = bodies[body];
+        for (int i = start; i < end; i++)
+            isRemoved.at(i) = true;
+        this->stats["functions folded"]++;
+    }
+    
+    if (this->foldedFunctions.empty())
+        return;
+    
+    vector<vector<string>> output;
+    for (int i = 0; i < input->size(); i++)
+    {
+        if (isRemoved.at(i))
+            continue;
+        if (input->at(i).at(0) == "function" && aliases.find(input->at(i).at(1)) != aliases.end())
+        {
+            vector<string> funcAliases = aliases[input->at(i).at(1)];
+            for (int j = 0; j < funcAliases.size(); j++)
+                output.push_back({"alias", funcAliases.at(j)});
+        }
+        output.push_back(input->at(i));
+    }
+    *input = output;
+    
+    return;
+}
+
+/**
+ * Creates the text used to compare function bodies. Two functions with the same text translate to the same asm.
+ * Labels are numbered in the order they first appear, calls to the function itself are marked as such,
+ * and static variables include the file name, since each file has its own.
+ * The text is used directly as a map key, so there are no hash collisions to worry about.
+ *
+ * @param input A pointer to the 2D string vector that is the parsed input.
+ * @param start The index of the function command.
+ * @param end The index after the last command of the function.
+ * @param fileName The vm file the function is in.
+ * @return The normalized function as a string.
+ */
+string Optimizer::normalizeFunction(vector<vector<string>>* input, int start, int end, string fileName)
+{
+    string funcName = input->at(start).at(1);
+    string output = "function " + input->at(start).at(2) + "\n";
+    map<string, int> labels;
+    
+    for (int i = start + 1; i < end; i++)
+    {
+        vector<string> curCom = input->at(i);
+        if (curCom.at(0) == "label" || curCom.at(0) == "goto" || curCom.at(0) == "if-goto")
+        {
+            string label = curCom.at(1);
+            transform(label.begin(), label.end(), label.begin(),::toupper); // Labels are case insensitive once translated.
+            if (labels.find(label) == labels.end())
+            {
+                int labelNum = labels.size();
+                labels[label] = labelNum;
+            }
+            curCom.at(1) = std::to_string(labels[label]);
+        }
+        else if (curCom.at(0) == "call" && curCom.at(1) == funcName)
+        {
+            curCom.at(1) = "<self>";
+        }
+        else if (curCom.size() > 2 && curCom.at(1) == "static")
+        {
+            curCom.at(2) = fileName + "." + curCom.at(2);
+        }
+        
+        for (int j = 0; j < curCom.size(); j++)
+            output += curCom.at(j) + " ";
+        output += "\n";
+    }
+    
+    return output;
+}
+
+/**
+ * Gets the functions removed by foldIdenticalFunctions.
+ *
+ * @return A map of each removed function's name to the name of the function it now shares code with.
+ */
+map<string, string> Optimizer::getFoldedFunctions()
+{
+    return this->foldedFunctions;
+}
+
+/**
+ * Describes what the optimization passes changed, one "<what>: <count>" line each.
+ *
+ * @return The stats as a string.
+ */
+string Optimizer::getStats()
+{
+    string output = "";
+    for (map<string, int>::iterator it = this->stats.begin(); it != this->stats.end(); it++)
+        output += it->first + ": " + std::to_string(it->second) + "\n";
+    
+    return output;
+}
+
+// Analyzer:
+
+/**
+ * Initializes values for the Analyzer.
+ */
+Analyzer::Analyzer()
+{
+    this->isWholeProgram = false;
+    
+    return;
+}
+
+/**
+ * Builds the call graph of the parsed vm program and works out which pointers each function may clobber.
+ * A function directly clobbers this/that if it pops into pointer 0/1. Writes through the this/that segments
+ * are assumed never to alias RAM[3-4], as the hack vm specification reserves RAM[0-15] for the vm implementation.
+ *
+ * @param input The 2D string vector that is the parsed input. It MUST have been parsed with Parser.
+ * @param isWholeProgram True if input is every file of the program, so no function can be called from code we don't see.
+ */
+void Analyzer::analyzeInput(vector<vector<string>> input, bool isWholeProgram)
+{
+    this->isWholeProgram = isWholeProgram;
+    this->functions.clear();
+    this->aliases.clear();
+    
+    this->variables.clear();
+    
+    string curFuncName = "";
+    string curFileName = "";
+    vector<string> curAliases; // Aliases of the next function.
+    vector<string> curCom;
+    for (int i = 0; i < input.size(); i++)
+    {
+        curCom = input.at(i);
+        if (curCom.size() > 2 && curCom.at(1) == "static") // Named like Translator::getExternalAddress does.
+            this->variables[curFileName + "." + curCom.at(2)] = true;
+        
+        if (curCom.at(0) == "function")
+        {
+            curFuncName = curCom.at(1);
+            this->functions[curFuncName] = FunctionInfo();
+            this->functions[curFuncName].nLocals = std::stoi(curCom.at(2));
+            for (int j = 0; j < curAliases.size(); j++)
+                this->aliases[curAliases.at(j)] = curFuncName;
+            curAliases.clear();
+        }
+        else if (curCom.at(0) == "alias")
+        {
+            curAliases.push_back(curCom.at(1));
+        }
+        else if (curCom.at(0) == "newfile")
+        {
+            curFuncName = ""; // Code before the first function of a file belongs to no function.
+            curFileName = curCom.at(1);
+        }
+        else if (curFuncName == "")
+        {
+            continue;
+        }
+        else if (curCom.at(0) == "call")
+        {
+            this->functions[curFuncName].callees.push_back(curCom.at(1));
+        }
+        else if (curCom.at(0) == "arrayload" || curCom.at(0) == "arraystore")
+        {
+            this->functions[curFuncName].clobbersThat = true;
+        }
+        else if (curCom.at(0) == "pop" && curCom.at(1) == "pointer")
+        {
+            if (curCom.at(2) == "0")
+                this->functions[curFuncName].clobbersThis = true;
+            else
+                this->functions[curFuncName].clobbersThat = true;
+        }
+    }
+    
+    propagateClobbers();
+    placeStaticFrames();
+    
+    return;
+}
+
+/**
+ * Spreads clobbered pointers up the call graph until nothing changes, so a caller clobbers everything its callees do.
+ * Calling a function that is not in the program can't be proven safe, so it clobbers both pointers.
+ */
+void Analyzer::propagateClobbers()
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (map<string, FunctionInfo>::iterator it = this->functions.begin(); it != this->functions.end(); it++)
+        {
+            FunctionInfo* info = &it->second;
+            for (int i = 0; i < info->callees.size(); i++)
+            {
+                map<string, FunctionInfo>::iterator callee = this->functions.find(resolveAlias(info->callees.at(i)));
+                bool calleeThis = (callee == this->functions.end()) || callee->second.clobbersThis;
+                bool calleeThat = (callee == this->functions.end()) || callee->second.clobbersThat;
+                
+                if (calleeThis && !info->clobbersThis)
+                {
+                    info->clobbersThis = true;
+                    changed = true;
+                }
+                if (calleeThat && !info->clobbersThat)
+                {
+                    info->clobbersThat = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    
+    return;
+}
+
+/**
+ * Gives every function that can't be running when it is called a static frame, if the program is whole.
+ * A frame is placed past the frames of every function that may be running when it is called, so frames
+ * are only shared by functions that never run at the same time. If the frames and the static variables
+ * don't both fit in RAM[16-255], the largest frames go back on the stack until they do.
+ */
+void Analyzer::placeStaticFrames()
+{
+    if (!this->isWholeProgram)
+        return;
+    
+    // A call to a function that isn't in the program leaves its name for the assembler to place as a variable:
+    for (map<string, FunctionInfo>::iterator it = this->functions.begin(); it != this->functions.end(); it++)
+    {
+        for (int i = 0; i < it->second.callees.size(); i++)
+        {
+            if (this->functions.find(resolveAlias(it->second.callees.at(i))) == this->functions.end())
+                this->variables[it->second.callees.at(i)] = true;
+        }
+    }
+    
+    map<string, bool> isStatic;
+    for (map<string, FunctionInfo>::iterator it = this->functions.begin(); it != this->functions.end(); it++)
+        isStatic[it->first] = !isRecursive(it->first);
+    
+    while (true)
+    {
+        // Longest path of frames to each function. Only functions on a cycle (which have no static frame) can repeat,
+        // so it settles after as many rounds as there are functions:
+        map<string, int> offsets;
+        for (int round = 0; round <= this->functions.size(); round++)
+        {
+            for (map<string, FunctionInfo>::iterator it = this->functions.begin(); it != this->functions.end(); it++)
+            {
+                int frameSize = isStatic[it->first] ? this->STATIC_FRAME_SLOTS.size() + it->second.nLocals : 0;
+                for (int i = 0; i < it->second.callees.size(); i++)
+                {
+                    string callee = resolveAlias(it->second.callees.at(i));
+                    if (this->functions.find(callee) != this->functions.end())
+                        offsets[callee] = std::max(offsets[callee], offsets[it->first] + frameSize);
+                }
+            }
+        }
+        
+        int totalSize = 0;
+        string largest = "";
+        for (map<string, FunctionInfo>::iterator it = this->functions.begin(); it != this->functions.end(); it++)
+        {
+            if (!isStatic[it->first])
+                continue;
+            totalSize = std::max(totalSize, offsets[it->first] + (int)this->STATIC_FRAME_SLOTS.size() + it->second.nLocals);
+            if (largest == "" || it->second.nLocals > this->functions[largest].nLocals)
+                largest = it->first;
+        }
+        
+        if (this->VARIABLE_BASE + this->variables.size() + totalSize <= this->STACK_BASE)
+        {
+            for (map<string, FunctionInfo>::iterator it = this->functions.begin(); it != this->functions.end(); it++)
+                it->second.frameBase = isStatic[it->first] ? this->STACK_BASE - totalSize + offsets[it->first] : -1;
+            return;
+        }
+        if (largest == "") // The static variables alone don't fit.
+            return;
+        isStatic[largest] = false;
+    }
+}
+
+/**
+ * Checks if a function may be called while it is already running, I.E. it can call itself through its callees.
+ *
+ * @param funcName The name of a function in the program.
+ * @return True if funcName can be reached from its own callees.
+ */
+bool Analyzer::isRecursive(string funcName)
+{
+    map<string, bool> visited;
+    vector<string> toVisit = this->functions[funcName].callees;
+    while (!toVisit.empty())
+    {
+        string curName = resolveAlias(toVisit.back());
+        toVisit.pop_back();
+        if (curName == funcName)
+            return true;
+        
+        map<string, FunctionInfo>::iterator it = this->functions.find(curName);
+        if (visited[curName] || it == this->functions.end())
+            continue;
+        visited[curName] = true;
+        toVisit.insert(toVisit.end(), it->second.callees.begin(), it->second.callees.end());
+    }
+    
+    return false;
+}
+
+/**
+ * Checks if a function has a static frame.
+ *
+ * @param funcName The name of the function.
+ * @return True if its locals, arguments base, and saved pointers are at fixed addresses.
+ */
+bool Analyzer::isStaticFrame(string funcName)
+{
+    map<string, FunctionInfo>::iterator it = this->functions.find(resolveAlias(funcName));
+    return it != this->functions.end() && it->second.frameBase >= 0;
+}
+
+/**
+ * Gets the address of a register in a function's static frame. The function must have one.
+ *
+ * @param funcName The name of the function.
+ * @param slot "return" (the return address), "argument" (the address of argument 0), "this" or "that" (the caller's pointer),
+ *             or "local".
+ * @param index The index of the local, for "local".
+ * @return The RAM address.
+ */
+int Analyzer::getStaticFrameAddress(string funcName, string slot, int index)
+{
+    int base = this->functions[resolveAlias(funcName)].frameBase;
+    if (slot == "local")
+        return base + this->STATIC_FRAME_SLOTS.size() + index;
+    
+    return base + std::find(this->STATIC_FRAME_SLOTS.begin(), this->STATIC_FRAME_SLOTS.end(), slot) - this->STATIC_FRAME_SLOTS.begin();
+}
+
+/**
+ * Gets the pointers that a frame for funcName has to save, in the order they are pushed on the stack.
+ * local and argument are always saved; this and that only if funcName may clobber them.
+ * Functions that can't be proven (not a whole program, or not defined in it) get the standard frame.
+ *
+ * @param funcName The name of the function being called or returned from.
+ * @return A vector<string> of pointer names, as found in Translator::STACK_BASE_NUMS.
+ */
+vector<string> Analyzer::getSavedPointers(string funcName)
+{
+    map<string, FunctionInfo>::iterator it = this->functions.find(resolveAlias(funcName));
+    if (!this->isWholeProgram || it == this->functions.end())
+        return this->FRAME_POINTERS;
+    
+    vector<string> output = {"local", "argument"};
+    if (it->second.clobbersThis)
+        output.push_back("this");
+    if (it->second.clobbersThat)
+        output.push_back("that");
+    
+    return output;
+}
+
+/**
+ * Gets the function a name belongs to, which is the name itself unless it was declared with "alias".
+ *
+ * @param funcName The name of a function.
+ * @return The name of the function whose code funcName runs.
+ */
+string Analyzer::resolveAlias(string funcName)
+{
+    map<string, string>::iterator it = this->aliases.find(funcName);
+    if (it == this->aliases.end())
+        return funcName;
+    return it->second;
+}
+
+// OutputWriter:
+
+/**
+ * Initializes values for the OutputWriter.
+ */
+OutputWriter::OutputWriter()
+{
+    this->isAsync = false;
+    this->isClosing = false;
+    
+    return;
+}
+
+/**
+ * Finishes writing, if the writer wasn't closed.
+ */
+OutputWriter::~OutputWriter()
+{
+    if (this->thread.joinable())
+        close();
+    
+    return;
+}
+
+/**
+ * Opens the output file, and starts the background writer thread if isAsync.
+ *
+ * @param path The path of the file to write.
+ * @param isAsync True to write blocks on a background thread, false to write them as they are handed over.
+ * @return 0 if the file was opened, 1 if not.
+ */
+int OutputWriter::open(string path, bool isAsync)
+{
+    this->file.open(path, ios::out);
+    if (!this->file.is_open())
+    {
+        cout << "Can't write " << path << "!\n";
+        return 1;
+    }
+    
+    this->isAsync = isAsync;
+    this->isClosing = false;
+    if (isAsync)
+        this->thread = std::thread(&OutputWriter::writeBlocks, this);
+    
+    return 0;
+}
+
+/**
+ * Hands a block of output over to be written. The block is taken, leaving it empty.
+ * Waits if MAX_QUEUED_BLOCKS are already waiting to be written.
+ *
+ * @param block A pointer to the block.
+ */
+void OutputWriter::write(string* block)
+{
+    if (!this->isAsync)
+    {
+        this->file.write(block->data(), block->length());
+        block->clear();
+        return;
+    }
+    
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->blocksChanged.wait(lock, [this]() { return this->blocks.size() < MAX_QUEUED_BLOCKS; });
+    this->blocks.push_back("");
+    this->blocks.back().swap(*block);
+    this->blocksChanged.notify_all();
+    lock.unlock();
+    
+    block->reserve(BLOCK_SIZE); // What the swap took.
+    
+    return;
+}
+
+/**
+ * Writes the blocks waiting to be written, in order, until the writer is closed. Runs on the background thread.
+ */
+void OutputWriter::writeBlocks()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true)
+    {
+        this->blocksChanged.wait(lock, [this]() { return !this->blocks.empty() || this->isClosing; });
+        if (this->blocks.empty()) // Closing, and everything is written.
+            return;
+        
+        string block = "";
+        block.swap(this->blocks.front());
+        this->blocks.pop_front();
+        this->blocksChanged.notify_all(); // There is room for another block.
+        
+        lock.unlock(); // Translation can go on while this block is written.
+        this->file.write(block.data(), block.length());
+        lock.lock();
+    }
+}
+
+/**
+ * Waits for every block to be written, and closes the file.
+ *
+ * @return 0 if everything was written, 1 if not.
+ */
+int OutputWriter::close()
+{
+    if (this->isAsync)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->isClosing = true;
+        this->blocksChanged.notify_all();
+        lock.unlock();
+        this->thread.join();
+    }
+    
+    bool isWritten = this->file.good();
+    this->file.close();
+    
+    return isWritten ? 0 : 1;
+}
+
+// Translator: 
+
+/**
+ * Initializes values for the Translator.
+ */
+Translator::Translator()
+{
+    this->output = "";
+    this->writer = NULL;
+    this->analyzer = NULL;
+    this->options = new Options();
+    this->fileName = fileName;
+    this->asmLineNum = 0;
+    this->profileBase = 0;
+    //this->curStaticNum = 0;
+    
+    initializePremadeASM();
+    
+    return;
+}
+
+/**
+ * Creates a string that is a comment version of vm's command.
+ *
+ * @param vm The vector<string> that contains the vm command.
+ * @return The comment as a string.
+ */
+string Translator::createVMComment(vector<string> vm)
+{
+    string output = "// ";
+    
+    for (int i = 0; i < vm.size(); i++)
+    {
+        output += vm.at(i) + " ";
+    }
+    
+    return output + ":\n";
+}
+
+ /**
+  * Translate a parsed vm command as a vector<string>.
+  *
+  * @param vm vector<string> of a vm command, being parsed by Parser.
+  */
+ void Translator::translateVMCom(vector<string> vm)
+ {
+    if (this->options->isEnabled("vstack") && translateVStackCom(vm)) // Let the virtual stack take it if it can.
+        return;
+    
+    if (vm.at(0) == "push" || vm.at(0) == "pop") // If it's a push/pop command:
+    {
+        if (this->options->isEnabled("select"))
+            translateSelectedPopPush(vm);
+        else
+            translatePopPush(vm);
+    }
+    else if (vm.at(0) == "label")
+    {
+        translateLabel(vm.at(1), false);
+    }
+    else if (vm.at(0).find("goto") != string::npos) // If the command is a goto or if-goto:
+    {
+        translateGoTo(vm, false);
     }
     else if (vm.at(0) == "function")
     {
-        translateFuncCom(vm);
+        translateFuncCom(vm);
+    }
+    else if (vm.at(0) == "call")
+    {
+        translateCallCom(vm);
+    }
+    else if (vm.at(0) == "return")
+    {
+        translateReturnCom();
+    }
+    else if (vm.at(0) == "newfile")
+    {
+        this->fileName = vm.at(1);
+    }
+    else if (vm.at(0) == "alias")
+    {
+        translateLabel(vm.at(1), true); // Declared right before the function it shares code with.
+    }
+    else if (vm.at(0) == "mulconst" || vm.at(0) == "divconst")
+    {
+        translateConstArith(vm);
+    }
+    else if (vm.at(0) == "arrayload" || vm.at(0) == "arraystore")
+    {
+        translateArrayAccess(vm);
+    }
+    else if (vm.at(0) == "discard")
+    {
+        addASMOutput("@" + getPointer("sp") + "\nM=M-1\n");
+    }
+    else // If it's any other (arithmetic/logical) command:
+    {
+        translateAL(vm.at(0));
+    }
+    
+    return;
+ }
+
+/**
+ * Translates a push or pop command into asm.
+ * Push takes the value at the address specified in vm.at(1-2) and puts it on the stack (*sp). sp is incremented by 1.
+ * Pop decrements sp by 1, then takes the value at sp (*sp) and stores it in the address specified in vm.at(1-2).
+ *
+ * @param vm A vector<string> containing a pop/push vm command.
+ */
+ void Translator::translatePopPush(vector<string> vm)
+ {
+    string externalAddress = ""; // externalAddress is to hold the address that's not from sp; The address specified by vm.at(1)&.at(2).
+    
+    /* Push logic:
+     *  Go to external address; Put M in D; Go to sp address; Store D in M; sp++.
+     *
+     * Pop logic:
+     *  Store external address in R13; Go to top stack value; Store M in D; Go to externalAddress(*R13); Store D in M.
+     */
+    
+    bool isConstant = false; // Needed because of the exact opposite needs of a constant value - Needed the address value rather than the value at the address.
+    bool isPush = false;
+    if (vm.at(0) == "push") 
+        isPush = true;
+    
+    // Get externalAddress:
+    if (vm.at(1) == "constant")
+        isConstant = true;
+    externalAddress = getExternalAddress(vm.at(1), vm.at(2));
+    
+    if (isPush) 
+    {
+        addASMOutput("@" + externalAddress + "\n"); // Go to externalAddress.
+        if (isConstant) // If it's a constant value wanted, we need to take the address value of externalAddress.
+            addASMOutput("D=A\n"); // Get externalAddress A value in D.
+        else
+            addASMOutput("D=M\n"); // Get value at externalAddress into D.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "\n"); // Go to the register sp is pointing to. (@*sp).
+        addASMOutput("M=D\n"); // Store D into *sp.
+        addASMOutput("@" + getPointer("sp") + "\nM=M+1\n"); // sp++
+    }
+    else 
+    {
+        addASMOutput("@"+ externalAddress + "\n"); // Go to externalAddress.
+        addASMOutput("D=A\n@R13\nM=D\n"); // Store externalAddress in R13.
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\n"); // Go to top value on the stack, and sp--.
+        addASMOutput("D=M\n"); // Store value at sp in D.
+        addASMOutput("@R13\n" + dereference + "\nM=D\n"); // Go to externalAddress and put D in it.
+    }
+    
+    return;
+ }
+ 
+/**
+ * Translates a push or pop command into asm, picking the cheapest way to address the segment with selectAccess.
+ * Push loads the value into D and stores it at *sp with sp++ in one go; Pop only uses R13 through the swapd pattern.
+ *
+ * @param vm A vector<string> containing a pop/push vm command.
+ */
+ void Translator::translateSelectedPopPush(vector<string> vm)
+ {
+    int index = std::stoi(vm.at(2));
+    if (vm.at(0) == "pop")
+    {
+        translateSelectedPop(vm.at(1), index);
+        return;
+    }
+    
+    string pushD = "@" + getPointer("sp") + "\nAM=M+1\nA=A-1\n"; // sp++, and go to *(sp-1).
+    if (vm.at(1) == "constant")
+    {
+        if (index <= 1)
+            addASMOutput(pushD + "M=" + vm.at(2) + "\n");
+        else
+            addASMOutput("@" + vm.at(2) + "\nD=A\n" + pushD + "M=D\n");
+        return;
+    }
+    
+    string code = "";
+    selectAccess(vm.at(1), index, true, &code);
+    addASMOutput(code + "D=M\n" + pushD + "M=D\n");
+    
+    return;
+ }
+ 
+/**
+ * Pops the top of the real stack into a memory segment, using the cheapest way to address it.
+ * The value has to be in D before the address is in A, so the address can't use D, unless the swap pattern is cheaper.
+ *
+ * @param segment The memory segment.
+ * @param index The index into segment.
+ */
+ void Translator::translateSelectedPop(string segment, int index)
+ {
+    string code = "";
+    string popD = "@" + getPointer("sp") + "\nAM=M-1\nD=M\n"; // sp--, and get *sp into D.
+    bool isIndirect = !isDirectSegment(segment);
+    
+    if (isIndirect && getAccessCost("swap", 0) < getAccessCost("chain", index - 1) + 4)
+    {
+        // D = address + value, then A = D - value and M = D - address:
+        addASMOutput("@" + std::to_string(index) + "\nD=A\n@" + getSegmentPointer(segment) + "\nD=D+M\n");
+        addASMOutput(popD.substr(0, popD.length() - 4) + "D=D+M\nA=D-M\nM=D-A\n");
+        return;
+    }
+    
+    addASMOutput(popD); // A isn't known after this, so there's nothing to reuse.
+    selectAccess(segment, index, false, &code);
+    addASMOutput(code + "M=D\n");
+    this->knownSegment = segment;
+    this->knownIndex = index;
+    
+    return;
+ }
+ 
+/**
+ * Stores D into a memory segment, using the cheapest way to address it that doesn't change D,
+ * or the swapd pattern through R13.
+ *
+ * @param segment The memory segment.
+ * @param index The index into segment.
+ */
+ void Translator::translateSelectedStoreD(string segment, int index)
+ {
+    string code = "";
+    int cost = selectAccess(segment, index, false, &code);
+    bool isIndirect = !isDirectSegment(segment);
+    
+    if (isIndirect && getAccessCost("swapd", 0) < cost + 1)
+    {
+        // R13 = value, D = address + value, then A = D - value and M = D - address:
+        addASMOutput("@R13\nM=D\n@" + std::to_string(index) + "\nD=A\n@" + getSegmentPointer(segment) + "\nD=D+M\n");
+        addASMOutput("@R13\nD=D+M\nA=D-M\nM=D-A\n");
+        return;
+    }
+    
+    addASMOutput(code + "M=D\n");
+    this->knownSegment = segment;
+    this->knownIndex = index;
+    
+    return;
+ }
+ 
+/**
+ * Picks the cheapest way to get A to the register of a memory segment and index, scored with ACCESS_COSTS.
+ * Which cost is compared first depends on the size/speed goal. The address already in A is reused if it is in the same segment.
+ *
+ * @param segment The memory segment (not constant).
+ * @param index The index into segment.
+ * @param canUseD False if D is holding a value, so patterns that use D can't be picked.
+ * @param code A pointer to a string that is set to the asm code ('\n' terminated).
+ * @return The cost of the pattern picked.
+ */
+ int Translator::selectAccess(string segment, int index, bool canUseD, string* code)
+ {
+    bool isDirect = isDirectSegment(segment);
+    int best = -1;
+    
+    for (int i = 0; i < this->ACCESS_COSTS.size(); i++)
+    {
+        string pattern = this->ACCESS_COSTS.at(i).at(0);
+        int steps = 0;
+        if (this->ACCESS_COSTS.at(i).at(6) == "1") // Whole pops are weighed by translateSelectedPop.
+            continue;
+        if (this->ACCESS_COSTS.at(i).at(5) == "1" && !canUseD)
+            continue;
+        if (pattern == "direct" && !isDirect)
+            continue;
+        if ((pattern == "chain" || pattern == "add") && isDirect)
+            continue;
+        if (pattern == "reuse")
+        {
+            // Statics are placed by the assembler, so only the same one can be reused.
+            if (this->knownSegment != segment || (segment == "static" && this->knownIndex != index))
+                continue;
+            steps = std::abs(index - this->knownIndex);
+        }
+        if (pattern == "chain")
+            steps = std::max(0, index - 1);
+        
+        int cost = getAccessCost(pattern, steps);
+        if (best != -1 && cost >= best)
+            continue;
+        
+        best = cost;
+        if (pattern == "direct")
+            *code = "@" + getExternalAddress(segment, std::to_string(index)) + "\n";
+        else if (pattern == "reuse")
+        {
+            *code = "";
+            for (int j = 0; j < steps; j++)
+                *code += (index > this->knownIndex) ? "A=A+1\n" : "A=A-1\n";
+        }
+        else if (pattern == "chain")
+        {
+            *code = "@" + getSegmentPointer(segment) + "\n" + (index == 0 ? "A=M\n" : "A=M+1\n");
+            for (int j = 0; j < steps; j++)
+                *code += "A=A+1\n";
+        }
+        else
+            *code = "@" + std::to_string(index) + "\nD=A\n@" + getSegmentPointer(segment) + "\nA=D+M\n";
+    }
+    
+    return best;
+ }
+ 
+/**
+ * Gets the cost of an addressing pattern from ACCESS_COSTS, for the size/speed goal.
+ * Ties between patterns are broken by the order they are tried in, so only the goal's cost is compared.
+ *
+ * @param pattern The name of the pattern.
+ * @param steps How many steps (A=A+1 or A=A-1) the pattern takes.
+ * @return The cost in asm lines when optimizing for size, otherwise in executed instructions.
+ */
+ int Translator::getAccessCost(string pattern, int steps)
+ {
+    int column = this->options->isOptimizeForSize() ? 1 : 3;
+    for (int i = 0; i < this->ACCESS_COSTS.size(); i++)
+    {
+        if (this->ACCESS_COSTS.at(i).at(0) == pattern)
+            return std::stoi(this->ACCESS_COSTS.at(i).at(column)) + steps * std::stoi(this->ACCESS_COSTS.at(i).at(column + 1));
+    }
+    
+    return 0;
+ }
+ 
+/**
+ * Gets the address specified by a memory segment and index, as used after an '@'.
+ * For temp, pointer, and static this is the address itself. For constant it is the value.
+ * For local, argument, this, and that it is asm code that ends with A set to register[<pointer>+<index>] (D is overwritten).
+ *
+ * @param segment The memory segment.
+ * @param index The index into segment, as a string.
+ * @return The address as a string, without the leading '@' or a trailing '\n'.
+ */
+ string Translator::getExternalAddress(string segment, string index)
+ {
+    if (segment == "temp")
+    { // temp registers start at reg 5, and there are 8 of them. 
+        return std::to_string(5 + std::stoi(index));
+    }
+    else if (segment == "pointer")
+    {
+        if (index == "0")
+            return getPointer("this"); // May need to be recursive; Future lesson should tell.
+        else
+            return getPointer("that");
+    }
+    else if (segment == "static")
+    {
+        //externalAddress = this->fileName + "." + std::to_string(this->curStaticNum) + "." + vm.at(2);
+        return this->fileName + "." + index;
+        //this->curStaticNum++;
+    }
+    else if (segment == "constant")
+    {
+        return index;
+    }
+    else if (segment == "local" && isStaticFrame(this->curFuncName))
+    {
+        return getStaticFrameAddress(this->curFuncName, "local", std::stoi(index));
+    }
+    
+    return getSegmentPointer(segment) + "\nD=M\n@" + index + "\nD=D+A\nA=D"; // asm code to go to register[<pointer>+<index>].
+ }
+ 
+/**
+ * Checks if a memory segment's registers are at fixed addresses, so they can be gone to with a single @<address>.
+ * These are temp, pointer, static, and local in a function with a static frame.
+ *
+ * @param segment The memory segment (not constant).
+ * @return True if the segment is direct, false if it is reached through a pointer.
+ */
+ bool Translator::isDirectSegment(string segment)
+ {
+    if (segment == "local")
+        return isStaticFrame(this->curFuncName);
+    return segment == "temp" || segment == "pointer" || segment == "static";
+ }
+ 
+/**
+ * Gets the register that points to an indirect memory segment. In a function with a static frame,
+ * argument is pointed to by the frame's argument base instead of the argument pointer.
+ *
+ * @param segment The memory segment: local, argument, this, or that.
+ * @return The address of the pointer register.
+ */
+ string Translator::getSegmentPointer(string segment)
+ {
+    if (segment == "argument" && isStaticFrame(this->curFuncName))
+        return getStaticFrameAddress(this->curFuncName, "argument", 0);
+    return getPointer(segment);
+ }
+ 
+/**
+ * Checks if a function has a static frame, which needs an Analyzer and the "static" pass.
+ *
+ * @param funcName The name of the function.
+ * @return True if the function's frame is at fixed addresses.
+ */
+ bool Translator::isStaticFrame(string funcName)
+ {
+    return this->analyzer != NULL && this->options->isEnabled("static") && this->analyzer->isStaticFrame(funcName);
+ }
+ 
+/**
+ * Gets the address of a register in a function's static frame, as used after an '@'.
+ *
+ * @param funcName The name of a function with a static frame.
+ * @param slot "return", "argument", "this", "that", or "local".
+ * @param index The index of the local, for "local".
+ * @return The address as a string.
+ */
+ string Translator::getStaticFrameAddress(string funcName, string slot, int index)
+ {
+    return std::to_string(this->analyzer->getStaticFrameAddress(funcName, slot, index));
+ }
+ 
+/**
+ * Translates an arithmetic/logic command into asm code.
+ * By convention, AL commands will only contain one string.
+ *
+ * @param vm A vector<string> containing an A/L vm command.
+ */
+ void Translator::translateAL(string vm)
+ {
+    if (vm == "add")
+    {
+        addASMOutput(this->getLastTwoVal + "\nM=M+D\n");
+    }
+    else if (vm == "sub")
+    {
+        addASMOutput(this->getLastTwoVal + "\nM=M-D\n");
+    }
+    else if (vm == "neg")
+    {
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-M\n");
+    }
+    else if (vm == "eq") // Equal
+    {
+        translateAL("sub");
+        addASMOutput("D=M\n");
+        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if eq.
+        addASMOutput("D;JEQ\n"); // If eq, jump to code for eq.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !eq.
+        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the eq code.
+        addASMOutput("0;JMP\n"); // Jump over the eq code.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for eq. 
+    }
+    else if (vm == "get") // Greater than or equal to
+    {
+        translateAL("sub");
+        addASMOutput("D=M\n");
+        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if get.
+        addASMOutput("D;JGE\n"); // If get, jump to code for get.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !get.
+        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the get code.
+        addASMOutput("0;JMP\n"); // Jump over the get code.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for get.
+    }
+    else if (vm == "lt") // Less than
+    {
+        translateAL("sub");
+        addASMOutput("D=M\n");
+        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if lt.
+        addASMOutput("D;JLT\n"); // If lt, jump to code for lt.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !lt.
+        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the lt code.
+        addASMOutput("0;JMP\n"); // Jump over the lt code.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for lt.
+    }
+    else if (vm == "gt") // Greater than
+    {
+        translateAL("sub");
+        addASMOutput("D=M\n");
+        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if gt.
+        addASMOutput("D;JGT\n"); // If gt, jump to code for gt.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !gt.
+        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the gt code.
+        addASMOutput("0;JMP\n"); // Jump over the gt code.
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for gt.
+    }
+    else if (vm == "and")
+    {
+        addASMOutput(this->getLastTwoVal + "\n"); // Get the top two values of the stack.
+        addASMOutput("M=D&M\n"); // Set register[*sp--] to the top two values "and"ed. 
+    }
+    else if (vm == "or")
+    {
+        addASMOutput(this->getLastTwoVal + "\n"); // Get the top two values of the stack.
+        addASMOutput("M=D|M\n"); // Set register[*sp--] to the top two values "or"ed. 
+    }
+    else if (vm == "not")
+    {
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\n"); // Go to the top value on the stack.
+        addASMOutput("M=!M\n"); // Set register[*sp--] to not itself (!M).
+    }
+    return;
+ }
+ 
+/**
+ * Translates vm label commands.
+ * A label is a marker in the code that can be returned to. It is used to reuse code.
+ * If the label is the start of a function, the function name must be in the format: <VMFileName>.<FunctionName>.
+ *
+ * @param labelName A string containing a label name.
+ * @param isFunc A bool that says whether the label is intended to be a function or not.
+ */
+ void Translator::translateLabel(string labelName, bool isFunc)
+ {
+    if (isFunc)
+    {
+        transform(labelName.begin(), labelName.end(), labelName.begin(),::toupper);
+        addASMOutput("(" + labelName + ")\n");
+    }
+    else
+    {
+        addASMOutput("(" + getLocalLabel(labelName) + ")\n");
+        if (this->options->getInstrument() >= 2)
+            addProfileCounter(getLocalLabel(labelName)); // Counts each time the label is reached, I.E. loop iterations.
+    }
+    return;
+ }
+ 
+/**
+ * Gets the asm name of a label declared inside the current function: <VMFileName>.<FunctionName>$<LABELNAME>.
+ *
+ * @param labelName The label name as written in the vm code.
+ * @return The asm label name.
+ */
+ string Translator::getLocalLabel(string labelName)
+ {
+    transform(labelName.begin(), labelName.end(), labelName.begin(),::toupper);
+    return this->fileName + "." + this->curFuncName + "$" + labelName;
+ }
+ 
+ /**
+ * Translates vm go-to commands. It can be conditional (if-goto) or unconditional (goto).
+ * The condition is based off the value on the top of the stack (*sp--).
+ * The goto refers to a label, which represents a point in the program. 
+ * If the command is conditional, the sp is decremented to overwrite the condition value.
+ * If the label is the start of a function, the function name must be in the format: <VMFileName>.<FunctionName>.
+ *
+ * @param goToCom A vector<string> containing a go-to vm command.
+ * @param isFunc A bool that says whether the label that we intend to go to is a function label or not.
+ */
+ void Translator::translateGoTo(vector<string> goToCom, bool isFunc)
+ {
+ // If the go to is a label, you need to add the prefix. If it is a function, you only need to add the fileName as a prefix.
+    transform(goToCom.at(1).begin(), goToCom.at(1).end(), goToCom.at(1).begin(),::toupper); // Make label name uppercase.
+    if (goToCom.at(0) == "goto")
+    {
+        if (!isFunc)
+            addASMOutput("@" + this->fileName + "." + this->curFuncName + "$" + goToCom.at(1) + "\n"); // Load the address for the label in question.
+        else 
+            addASMOutput("@" + goToCom.at(1) + "\n"); // Load the address for the label in question.
+        addASMOutput("0;JMP\n"); // Jump the code to the label.
     }
-    else if (vm.at(0) == "call")
+    else // If the command is if-goto:
     {
-        translateCallCom(vm);
+        addASMOutput("@" + getPointer("sp") + "\nM=M-1\n" + dereference + "\n"); // Go to *sp-- and decrement sp.
+        addASMOutput("D=M\n"); // Save the value of the top of the stack in D (it should be either true (-1) or false (0)).
+        if (!isFunc)
+            addASMOutput("@" + this->fileName + "." + this->curFuncName + "$" + goToCom.at(1) + "\n"); // Load the address for the label in question.
+        else
+            addASMOutput("@" + this->fileName + "." + goToCom.at(1) + "\n"); // Load the address for the label in question.
+        addASMOutput("D;JNE\n"); // Jump if D is true (-1; Jump if D != 0).
+    }
+    
+    return;
+ }
+ 
+/**
+ * Translates a call to a function with a static frame. Nothing is pushed; The frame's registers are set instead:
+ * The argument base is set to sp - <nArgs>, the caller's this/that are saved if the callee may clobber them,
+ * and the return address is saved. local and argument are never changed by the callee, so they aren't saved.
+ *
+ * @param callCom A vector<string> containing a call vm command.
+ */
+ void Translator::translateStaticCall(vector<string> callCom)
+ {
+    string funcName = callCom.at(1);
+    int nArgs = (callCom.size() > 2) ? std::stoi(callCom.at(2)) : 0;
+    
+    // Set the argument base:
+    if (nArgs <= 1)
+        addASMOutput("@" + getPointer("sp") + "\nD=M" + (nArgs == 1 ? "-1" : "") + "\n");
+    else
+        addASMOutput("@" + std::to_string(nArgs) + "\nD=A\n@" + getPointer("sp") + "\nD=M-D\n");
+    addASMOutput("@" + getStaticFrameAddress(funcName, "argument", 0) + "\nM=D\n");
+    
+    // Save this and that, if the callee may clobber them:
+    vector<string> savedPointers = getSavedPointers(funcName);
+    for (int i = 0; i < savedPointers.size(); i++)
+    {
+        if (savedPointers.at(i) == "this" || savedPointers.at(i) == "that")
+            addASMOutput("@" + getPointer(savedPointers.at(i)) + "\nD=M\n@" + getStaticFrameAddress(funcName, savedPointers.at(i), 0) + "\nM=D\n");
+    }
+    
+    // Save the return address. The call code after it is 4 lines to save it, and 2 to jump:
+    string returnAdd = std::to_string(this->asmLineNum + 4 + 2);
+    addASMOutput("@" + returnAdd + "\nD=A\n@" + getStaticFrameAddress(funcName, "return", 0) + "\nM=D\n");
+    
+    output += createVMComment({"goto", funcName}); // Add a comment for this command.
+    translateGoTo({"goto", funcName}, true);
+    
+    return;
+ }
+ 
+/**
+ * Translates a return from a function with a static frame.
+ * The return value is stored at the argument base and sp is set past it, the caller's this/that are
+ * restored if they were saved, and the code jumps to the saved return address.
+ */
+ void Translator::translateStaticReturn()
+ {
+    if (this->options->isEnabled("vstack"))
+    {
+        vStackPopToD(); // Put the return value in D.
+        this->vStack.clear(); // Anything else on the stack is thrown away with the frame.
+    }
+    else
+        addASMOutput("@" + getPointer("sp") + "\nA=M-1\nD=M\n"); // Put the return value in D.
+    
+    // *argument base = return value, and sp = argument base + 1:
+    addASMOutput("@" + getStaticFrameAddress(this->curFuncName, "argument", 0) + "\nA=M\nM=D\nD=A+1\n@" + getPointer("sp") + "\nM=D\n");
+    
+    vector<string> savedPointers = getSavedPointers(this->curFuncName);
+    for (int i = 0; i < savedPointers.size(); i++)
+    {
+        if (savedPointers.at(i) == "this" || savedPointers.at(i) == "that")
+            addASMOutput("@" + getStaticFrameAddress(this->curFuncName, savedPointers.at(i), 0) + "\nD=M\n@" + getPointer(savedPointers.at(i)) + "\nM=D\n");
+    }
+    
+    addASMOutput("@" + getStaticFrameAddress(this->curFuncName, "return", 0) + "\nA=M\n0;JMP\n");
+    
+    return;
+ }
+ 
+/**
+ * Translates the vm function command: function <functionName> <nVars>.
+ * This command defines a function in the code to be reused. 
+ * A function can take some arguments, have some local variables, and always returns one value.
+ * <functionName> is the desired name of the function. This will be accessed via a label.
+ * <nVars> specifies how many local variables this function has. They are initialized to 0.
+ *
+ * @param funcCom A vector<string> containing a function vm command.
+ */
+ void Translator::translateFuncCom(vector<string> funcCom)
+ {
+    this->curFuncName = funcCom.at(1);
+    output += createVMComment({"label", funcCom.at(1)}); // Add a comment for this command.
+    translateLabel(funcCom.at(1), true);
+    
+    if (this->options->getInstrument() >= 1)
+        addProfileCounter(funcCom.at(1)); // Counts calls to this function.
+    
+    if (isStaticFrame(funcCom.at(1)))
+    {
+        for (int i = 0; i < std::stoi(funcCom.at(2)); i++)
+            addASMOutput("@" + getStaticFrameAddress(funcCom.at(1), "local", i) + "\nM=0\n"); // Zero the local.
+    }
+    else
+        translateLocalInit(std::stoi(funcCom.at(2)));
+    
+    return;
+ }
+ 
+/**
+ * Translates the start of a function that pushes nVars zeros for its local variables.
+ * When called, sp == local, so the locals are the nVars registers starting at *sp.
+ * There are three ways to do this; the cheapest one for the size/speed goal is used (always unrolled without the "locals" pass):
+ *  - Unrolled: nVars copies of push constant 0 (7 lines each).
+ *  - Compact: Walk A over the locals setting M=0, then set sp once (2 lines per local + 4).
+ *  - Loop: A counted loop doing sp++ and *(sp-1)=0 (9 lines, but 7 executed instructions per local + 2).
+ *
+ * @param nVars The number of local variables of the function.
+ */
+ void Translator::translateLocalInit(int nVars)
+ {
+    if (nVars <= 0)
+        return;
+    
+    // {size, executed instructions} for unrolled, compact, and loop:
+    int costs[3][2] = {{7 * nVars, 7 * nVars}, {2 * nVars + 4, 2 * nVars + 4}, {9, 7 * nVars + 2}};
+    if (nVars == 1) // A single local can just use sp++.
+        costs[1][0] = costs[1][1] = 5;
+    
+    int primary = this->options->isOptimizeForSize() ? 0 : 1; // Cost compared first.
+    int best = 0;
+    for (int i = 1; i < 3 && this->options->isEnabled("locals"); i++)
+    {
+        if (costs[i][primary] < costs[best][primary] || 
+            (costs[i][primary] == costs[best][primary] && costs[i][1 - primary] < costs[best][1 - primary]))
+            best = i;
+    }
+    
+    if (best == 0)
+    {
+        for (int i = 0; i < nVars; i++)
+            translatePopPush({"push", "constant", "0"});
+    }
+    else if (best == 1)
+    {
+        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "\nM=0\n"); // Go to *sp and zero the first local.
+        for (int i = 1; i < nVars; i++)
+            addASMOutput("A=A+1\nM=0\n"); // Zero the next local.
+        if (nVars == 1)
+            addASMOutput("@" + getPointer("sp") + "\nM=M+1\n"); // sp++
+        else
+            addASMOutput("D=A+1\n@" + getPointer("sp") + "\nM=D\n"); // sp = the register after the last local.
+    }
+    else
+    {
+        addASMOutput("@" + std::to_string(nVars) + "\nD=A\n"); // D counts the locals left to zero.
+        string loopStart = std::to_string(this->asmLineNum);
+        addASMOutput("@" + getPointer("sp") + "\nAM=M+1\nA=A-1\nM=0\n"); // sp++, and zero *(sp-1).
+        addASMOutput("D=D-1\n@" + loopStart + "\nD;JGT\n"); // Loop until every local is zeroed.
+    }
+    
+    return;
+ }
+ 
+/**
+ * Translates the vm function command: function <functionName> <nArgs>.
+ * This command runs the pre-defined code in the function <functionName>.
+ * <nArgs> specifies how many arguments <functionName> takes from the stack.
+ *
+ * @param callCom A vector<string> containing a call vm command.
+ */
+ void Translator::translateCallCom(vector<string> callCom)
+ {
+    if (isStaticFrame(callCom.at(1)))
+    {
+        translateStaticCall(callCom);
+        return;
+    }
+    
+    // Save return address, local, argument, and whichever of this and that the callee may clobber:
+    vector<string> savedPointers = getSavedPointers(callCom.at(1));
+    int frameSize = savedPointers.size() + 1; // The saved pointers plus the return address.
+    
+    // Push return address:
+    // The call code after it is 7 lines per saved pointer, 5 to set local and jump, and 7 more to set argument.
+    string returnAdd = "";
+    if (callCom.size() > 2) // Need to skip all the following call code for the return address.
+        returnAdd = std::to_string(this->asmLineNum + 7 + 7 * savedPointers.size() + 12);
+    else
+        returnAdd = std::to_string(this->asmLineNum + 7 + 7 * savedPointers.size() + 5); // Doesn't have to skip the conditional code for arguments.
+    output += createVMComment({"push", "constant", returnAdd}); // Add a comment for this command.
+    translatePopPush({"push", "constant", returnAdd});
+    
+    // Push the saved pointers:
+    for (int i = 0; i < savedPointers.size(); i++)
+    {
+        addASMOutput("@" + getPointer(savedPointers.at(i)) + "\nD=M\n"); // Go to  pointer. Put M in D.
+        addASMOutput("@" + getPointer("sp") + "\nA=M\nM=D\n"); // Save  pointer value at *sp.
+        addASMOutput("@" + getPointer("sp") + "\nM=M+1\n"); // sp++.
+    }
+    
+    // Adjust argument segment pointer using callCom.at(3): 
+    if (callCom.size() > 2) // If the function has arguments.
+    {
+        addASMOutput("@" + std::to_string(stoi(callCom.at(2)) + frameSize) + "\nD=A\n");
+        addASMOutput("@" + getPointer("sp") + "\nD=M-D\n");
+        addASMOutput("@" + getPointer("argument") + "\nM=D\n");
+        
+        // Adjust local segment to point to the upcoming local vars:
+        addASMOutput("@" + getPointer("sp") + "\n");
+    }
+    // count. 
+    addASMOutput("D=M\n"); // Don't need to get sp again since it's already the current address.
+    addASMOutput("@" + getPointer("local") + "\nM=D\n");
+    
+    // Go to function:
+    
+    output += createVMComment({"goto", callCom.at(1)}); // Add a comment for this command.
+    translateGoTo({"goto", callCom.at(1)}, true);
+    
+    return;
+ }
+ 
+/**
+ * Translates the vm return command.
+ * This command resets the stack, so that the function we are currently in returns a value to the stack instead of 
+ * All it's processing that was previously on the stack. The return value will be located where the original first argument was.
+ *
+ * Previous states of the local, argument, this, and that pointers are saved on the stack relative to the current local pointer.
+ * In the standard frame:
+ * The saved that is at local - 1.
+ * this is at local - 2.
+ * argument is at local - 3.
+ * local is at local - 4.
+ * The return address is in local - 5.
+ * If the current function can't clobber this or that, they were not saved by the call, and the frame is smaller.
+ *
+ * The return value will be located at *sp--.
+ */
+ void Translator::translateReturnCom()
+ {
+    if (isStaticFrame(this->curFuncName))
+    {
+        translateStaticReturn();
+        return;
+    }
+    
+    // Save return value at R13:
+    if (this->options->isEnabled("vstack"))
+    {
+        vStackPopToD(); // Put the return value in D.
+        this->vStack.clear(); // Anything else on the stack is thrown away with the frame.
+    }
+    else
+        addASMOutput("@" + getPointer("sp") + "\nA=M-1\nD=M\n"); // Put the return value in D.
+    addASMOutput("@R13\nM=D\n"); // Save D at R13 for now.
+    
+    // Save argument at R14; sp should be set here once return is finished.
+    addASMOutput("@" + getPointer("argument") + "\nD=M\n@R14\nM=D\n");
+    
+    // Set sp to current local:
+    addASMOutput("@" + getPointer("local") + "\nD=M\n@" + getPointer("sp") + "\nM=D\n"); // Set sp to local.
+    
+    //  Reset the saved pointers, in the opposite order they were pushed:
+    vector<string> savedPointers = getSavedPointers(this->curFuncName);
+    for (int i = savedPointers.size() - 1; i >= 0; i--)
+    {
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\n"); // Decrement and go to *sp.
+        addASMOutput("D=M\n"); // Get value of M into D. This is a saved value for resetting the pointers.
+        addASMOutput("@" + getPointer(savedPointers.at(i)) + "\nM=D\n"); // Set the pointer to this saved value.
     }
+    
+    // Save the return address at R15:
+    addASMOutput("@" + getPointer("sp") + "\nAM=M-1\n"); // Decrement and go to *sp.
+    addASMOutput("D=M\n"); // Put return address in D.
+    addASMOutput("@R15\nM=D\n"); // Store return address in R15 temporarily.
+    
+    // Set sp to the value at R14:
+    addASMOutput("@R14\nD=M\n@" + getPointer("sp") + "\nM=D\n");
+    
+    // Push return value (R13):
+    addASMOutput("@R13\nD=M\n@" + getPointer("sp") + "\n" + dereference + "\nM=D\n");
+    addASMOutput("@" + getPointer("sp") + "\n" + "M=M+1\n"); // sp++
+    
+    
+    // Jump to return address at R15:
+    addASMOutput("@R15\nA=M\n"); // Go to *R15.
+    addASMOutput("0;JMP\n"); // Jump.
+    return;
+ }
+ 
+/**
+ * Translates a vm command with the virtual stack, if it is one the virtual stack handles.
+ * push, pop, and the arithmetic/logic commands work on vStack; values are only stored on the real stack,
+ * and sp only moved once, at basic block boundaries (labels, gotos, functions, calls, and returns).
+ * Any other command is a boundary, so vStack is flushed before it is translated normally.
+ *
+ * @param vm vector<string> of a vm command, being parsed by Parser.
+ * @return True if the command was translated, false if it still needs to be.
+ */
+ bool Translator::translateVStackCom(vector<string> vm)
+ {
+    if (vm.at(0) == "push")
+        vStackPush(vm);
+    else if (vm.at(0) == "pop")
+        vStackPop(vm);
+    else if (vm.at(0) == "if-goto")
+        vStackIfGoTo(vm);
+    else if (vm.at(0) == "discard" && !this->vStack.empty())
+        this->vStack.pop_back(); // It was never stored below sp.
+    else if (vm.at(0) == "discard")
+        return false;
     else if (vm.at(0) == "return")
+        return false; // translateReturnCom takes the return value straight off vStack.
+    else if (vm.at(0) == "mulconst" || vm.at(0) == "divconst")
+        return false; // translateConstArith works with vStack itself.
+    else if (vm.at(0) == "arrayload" || vm.at(0) == "arraystore")
+        return false; // So does translateArrayAccess.
+    else if (vm.at(0) == "label" || vm.at(0) == "goto" || vm.at(0) == "function" || vm.at(0) == "call" || vm.at(0) == "newfile" || vm.at(0) == "alias")
     {
-        translateReturnCom();
+        flushVStack(0);
+        return false;
     }
-    else if (vm.at(0) == "newfile")
+    else
+        vStackAL(vm.at(0));
+    
+    return true;
+ }
+ 
+/**
+ * Pushes onto the virtual stack. Constants are only remembered; Anything else is loaded into D.
+ *
+ * @param vm A vector<string> containing a push vm command.
+ */
+ void Translator::vStackPush(vector<string> vm)
+ {
+    StackValue value;
+    if (vm.at(1) == "constant")
     {
-        this->fileName = vm.at(1);
+        value.kind = CONST_VALUE;
+        value.value = std::stoi(vm.at(2));
     }
-    else // If it's any other (arithmetic/logical) command:
+    else if (this->options->isEnabled("select"))
     {
-        translateAL(vm.at(0));
+        vStackFreeD();
+        string code = "";
+        selectAccess(vm.at(1), std::stoi(vm.at(2)), true, &code);
+        addASMOutput(code + "D=M\n");
+        this->knownSegment = vm.at(1);
+        this->knownIndex = std::stoi(vm.at(2));
+        value.kind = D_VALUE;
+        value.value = 0;
+    }
+    else
+    {
+        vStackFreeD();
+        addASMOutput("@" + getExternalAddress(vm.at(1), vm.at(2)) + "\nD=M\n"); // Get value at externalAddress into D.
+        value.kind = D_VALUE;
+        value.value = 0;
     }
+    this->vStack.push_back(value);
     
     return;
  }
-
+ 
+/**
+ * Pops the top of the virtual stack (or the real stack, if vStack is empty) into a memory segment.
+ *
+ * @param vm A vector<string> containing a pop vm command.
+ */
+ void Translator::vStackPop(vector<string> vm)
+ {
+    string externalAddress = getExternalAddress(vm.at(1), vm.at(2));
+    bool isDirect = isDirectSegment(vm.at(1));
+    
+    if (this->options->isEnabled("select"))
+    {
+        int index = std::stoi(vm.at(2));
+        if (this->vStack.empty())
+        {
+            translateSelectedPop(vm.at(1), index);
+            return;
+        }
+        
+        StackValue top = this->vStack.back();
+        if (top.kind == CONST_VALUE && top.value >= -1 && top.value <= 1) // Small constants can be stored without D.
+        {
+            this->vStack.pop_back();
+            string code = "";
+            if (!isDirect && selectAccess(vm.at(1), index, false, &code) > getAccessCost("add", 0)) // Direct segments never need D.
+                vStackFreeD();
+            selectAccess(vm.at(1), index, true, &code);
+            addASMOutput(code + "M=" + std::to_string(top.value) + "\n");
+            this->knownSegment = vm.at(1);
+            this->knownIndex = index;
+            return;
+        }
+        
+        vStackPopToD();
+        translateSelectedStoreD(vm.at(1), index);
+        return;
+    }
+    
+    if (!this->vStack.empty() && this->vStack.back().kind == CONST_VALUE)
+    {
+        int value = this->vStack.back().value;
+        this->vStack.pop_back();
+        if (isDirect && value >= -1 && value <= 1) // Small constants can be stored without D.
+        {
+            addASMOutput("@" + externalAddress + "\nM=" + std::to_string(value) + "\n");
+            return;
+        }
+        vStackFreeD();
+        if (!isDirect) // Store the address in R13, before D is needed for the value.
+            addASMOutput("@" + externalAddress + "\nD=A\n@R13\nM=D\n");
+        addASMOutput(getConstToD(value) + "\n");
+    }
+    else if (isDirect)
+    {
+        vStackPopToD();
+    }
+    else if (this->vStack.empty()) // Same as a plain pop.
+    {
+        addASMOutput("@" + externalAddress + "\nD=A\n@R13\nM=D\n"); // Store externalAddress in R13.
+        vStackPopToD();
+    }
+    else // The value has to be kept in R14 while D is used for the address.
+    {
+        vStackPopToD();
+        addASMOutput("@R14\nM=D\n");
+        addASMOutput("@" + externalAddress + "\nD=A\n@R13\nM=D\n"); // Store externalAddress in R13.
+        addASMOutput("@R14\nD=M\n");
+    }
+    
+    if (isDirect)
+        addASMOutput("@" + externalAddress + "\nM=D\n"); // Put D in externalAddress.
+    else
+        addASMOutput("@R13\n" + dereference + "\nM=D\n"); // Go to externalAddress(*R13) and put D in it.
+    
+    return;
+ }
+ 
 /**
- * Translates a push or pop command into asm.
- * Push takes the value at the address specified in vm.at(1-2) and puts it on the stack (*sp). sp is incremented by 1.
- * Pop decrements sp by 1, then takes the value at sp (*sp) and stores it in the address specified in vm.at(1-2).
+ * Translates an arithmetic/logic command on the virtual stack.
+ * Constant operands are folded. Results that aren't constant are left in D, except when both operands
+ * are on the real stack, where the plain in place asm is used.
+ * The comparisons produce their true (-1) or false (0) in D.
  *
- * @param vm A vector<string> containing a pop/push vm command.
+ * @param vm A string containing an A/L vm command.
  */
- void Translator::translatePopPush(vector<string> vm)
+ void Translator::vStackAL(string vm)
  {
-    string externalAddress = ""; // externalAddress is to hold the address that's not from sp; The address specified by vm.at(1)&.at(2).
-    
-    /* Push logic:
-     *  Go to external address; Put M in D; Go to sp address; Store D in M; sp++.
-     *
-     * Pop logic:
-     *  Store external address in R13; Go to top stack value; Store M in D; Go to externalAddress(*R13); Store D in M.
-     */
-    
-    bool isConstant = false; // Needed because of the exact opposite needs of a constant value - Needed the address value rather than the value at the address.
-    bool isPush = false;
-    if (vm.at(0) == "push") 
-        isPush = true;
+    int size = this->vStack.size();
     
-    // Get externalAddress:
-    if (vm.at(1) == "temp")
-    { // temp registers start at reg 5, and there are 8 of them. 
-        externalAddress = std::to_string(5 + std::stoi(vm.at(2)));
-    }
-    else if (vm.at(1) == "pointer")
+    if (vm == "neg" || vm == "not")
     {
-        if (vm.at(2) == "0")
-            externalAddress = getPointer("this"); // May need to be recursive; Future lesson should tell.
+        string comp = (vm == "neg") ? "-" : "!";
+        if (size == 0)
+        {
+            translateAL(vm);
+        }
+        else if (this->vStack.back().kind == CONST_VALUE)
+        {
+            int value = this->vStack.back().value;
+            this->vStack.back().value = (vm == "neg") ? (short)(-value) : (short)(~value);
+        }
+        else if (this->vStack.back().kind == D_VALUE)
+        {
+            addASMOutput("D=" + comp + "D\n");
+        }
         else
-            externalAddress = getPointer("that");
+        {
+            addASMOutput(getSlotAddress(size - 1) + "M=" + comp + "M\n");
+        }
+        return;
     }
-    else if (vm.at(1) == "static")
+    
+    bool isCompare = (vm == "eq" || vm == "get" || vm == "lt" || vm == "gt");
+    string op = "+";
+    if (vm == "sub" || isCompare)
+        op = "-";
+    else if (vm == "and")
+        op = "&";
+    else if (vm == "or")
+        op = "|";
+    
+    if (size >= 2 && this->vStack.at(size - 2).kind == CONST_VALUE && this->vStack.back().kind == CONST_VALUE) // Fold it.
     {
-        //externalAddress = this->fileName + "." + std::to_string(this->curStaticNum) + "." + vm.at(2);
-        externalAddress = this->fileName + "." + vm.at(2);
-        //this->curStaticNum++;
+        int x = this->vStack.at(size - 2).value;
+        int y = this->vStack.back().value;
+        this->vStack.pop_back();
+        
+        int result = (short)(x + y);
+        if (op == "-")
+            result = (short)(x - y);
+        else if (op == "&")
+            result = x & y;
+        else if (op == "|")
+            result = x | y;
+        
+        if (vm == "eq")
+            result = (result == 0) ? -1 : 0;
+        else if (vm == "get")
+            result = (result >= 0) ? -1 : 0;
+        else if (vm == "lt")
+            result = (result < 0) ? -1 : 0;
+        else if (vm == "gt")
+            result = (result > 0) ? -1 : 0;
+        
+        this->vStack.back().value = result;
+        return;
     }
-    else if (vm.at(1) == "constant")
+    
+    // x is the second value from the top, y is the top. Get D = x <op> y:
+    if (size == 0)
     {
-        isConstant = true;
-        externalAddress = vm.at(2);
+        if (!isCompare)
+        {
+            translateAL(vm); // Both are on the real stack, so do it in place.
+            return;
+        }
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\nD=M\n"); // y into D. sp--.
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\nD=M" + op + "D\n"); // x <op> y into D. sp--.
     }
-    else
+    else if (size == 1) // x is on the real stack.
     {
-        externalAddress = getPointer(vm.at(1)) + "\nD=M\n@" + vm.at(2) + "\nD=D+A\nA=D"; // asm code to go to register[<pointer>+<index>].
+        vStackPopToD();
+        string comp = (op == "-") ? "M-D" : "D" + op + "M";
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\nD=" + comp + "\n"); // x <op> y into D. sp--.
     }
-    
-    if (isPush) 
+    else
     {
-        addASMOutput("@" + externalAddress + "\n"); // Go to externalAddress.
-        if (isConstant) // If it's a constant value wanted, we need to take the address value of externalAddress.
-            addASMOutput("D=A\n"); // Get externalAddress A value in D.
+        StackValue x = this->vStack.at(size - 2);
+        StackValue y = this->vStack.back();
+        
+        if (x.kind != D_VALUE && y.kind != D_VALUE) // Put y in D.
+        {
+            vStackFreeD();
+            vStackLoadD(size - 1);
+            y.kind = D_VALUE;
+        }
+        
+        // One of them is in D, the other is a constant (into A) or on the stack (into M):
+        StackValue other = (x.kind == D_VALUE) ? y : x;
+        string reg = "M";
+        if (other.kind == CONST_VALUE)
+        {
+            addASMOutput(getConstToA(other.value) + "\n");
+            reg = "A";
+        }
         else
-            addASMOutput("D=M\n"); // Get value at externalAddress into D.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "\n"); // Go to the register sp is pointing to. (@*sp).
-        addASMOutput("M=D\n"); // Store D into *sp.
-        addASMOutput("@" + getPointer("sp") + "\nM=M+1\n"); // sp++
+            addASMOutput(getSlotAddress(size - ((x.kind == D_VALUE) ? 1 : 2)));
+        
+        string comp = "D" + op + reg;
+        if (op == "-" && y.kind == D_VALUE)
+            comp = reg + "-D";
+        addASMOutput("D=" + comp + "\n");
+        
+        this->vStack.pop_back();
+        this->vStack.pop_back();
     }
-    else 
+    
+    if (isCompare) // D is x - y, turn it into true or false:
     {
-        addASMOutput("@"+ externalAddress + "\n"); // Go to externalAddress.
-        addASMOutput("D=A\n@R13\nM=D\n"); // Store externalAddress in R13.
-        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\n"); // Go to top value on the stack, and sp--.
-        addASMOutput("D=M\n"); // Store value at sp in D.
-        addASMOutput("@R13\n" + dereference + "\nM=D\n"); // Go to externalAddress and put D in it.
+        string jump = "JEQ";
+        if (vm == "get")
+            jump = "JGE";
+        else if (vm == "lt")
+            jump = "JLT";
+        else if (vm == "gt")
+            jump = "JGT";
+        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\nD;" + jump + "\n"); // Jump to the true code.
+        addASMOutput("D=0\n@" + std::to_string(this->asmLineNum + 4) + "\n0;JMP\n"); // False, and jump over the true code.
+        addASMOutput("D=-1\n"); // True.
     }
     
+    StackValue result;
+    result.kind = D_VALUE;
+    result.value = 0;
+    this->vStack.push_back(result);
+    
     return;
  }
  
 /**
- * Translates an arithmetic/logic command into asm code.
- * By convention, AL commands will only contain one string.
+ * Translates an if-goto command with the virtual stack. The condition is taken straight from vStack,
+ * and a constant condition becomes a goto, or nothing at all.
  *
- * @param vm A vector<string> containing an A/L vm command.
+ * @param goToCom A vector<string> containing an if-goto vm command.
  */
- void Translator::translateAL(string vm)
+ void Translator::vStackIfGoTo(vector<string> goToCom)
  {
-    if (vm == "add")
-    {
-        addASMOutput(this->getLastTwoVal + "\nM=M+D\n");
-    }
-    else if (vm == "sub")
-    {
-        addASMOutput(this->getLastTwoVal + "\nM=M-D\n");
-    }
-    else if (vm == "neg")
+    flushVStack(1); // Everything under the condition has to be on the real stack before the jump.
+    
+    if (!this->vStack.empty() && this->vStack.back().kind == CONST_VALUE)
     {
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-M\n");
+        int value = this->vStack.back().value;
+        this->vStack.pop_back();
+        if (value != 0)
+            addASMOutput("@" + getLocalLabel(goToCom.at(1)) + "\n0;JMP\n");
+        return;
     }
-    else if (vm == "eq") // Equal
+    
+    vStackPopToD(); // Get the condition in D.
+    addASMOutput("@" + getLocalLabel(goToCom.at(1)) + "\n");
+    addASMOutput("D;JNE\n"); // Jump if D is true (-1; Jump if D != 0).
+    
+    return;
+ }
+ 
+/**
+ * Pops the top of the virtual stack into D. If vStack is empty, pops the real stack (sp--).
+ */
+ void Translator::vStackPopToD()
+ {
+    if (this->vStack.empty())
     {
-        translateAL("sub");
-        addASMOutput("D=M\n");
-        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if eq.
-        addASMOutput("D;JEQ\n"); // If eq, jump to code for eq.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !eq.
-        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the eq code.
-        addASMOutput("0;JMP\n"); // Jump over the eq code.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for eq. 
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\nD=M\n");
+        return;
     }
-    else if (vm == "get") // Greater than or equal to
+    
+    if (this->vStack.back().kind != D_VALUE)
+        vStackFreeD(); // A value further down the stack may be in D.
+    
+    vStackLoadD(this->vStack.size() - 1);
+    this->vStack.pop_back();
+    
+    return;
+ }
+ 
+/**
+ * Gets the value of vStack.at(slot) into D, without removing it. D must not be holding a different value.
+ *
+ * @param slot The index of the value in vStack.
+ */
+ void Translator::vStackLoadD(int slot)
+ {
+    StackValue value = this->vStack.at(slot);
+    if (value.kind == CONST_VALUE)
+        addASMOutput(getConstToD(value.value) + "\n");
+    else if (value.kind == MEM_VALUE)
+        addASMOutput(getSlotAddress(slot) + "D=M\n");
+    
+    return;
+ }
+ 
+/**
+ * Makes D free to use, by storing the D_VALUE on vStack (if there is one) at its stack register.
+ */
+ void Translator::vStackFreeD()
+ {
+    for (int i = 0; i < this->vStack.size(); i++)
     {
-        translateAL("sub");
-        addASMOutput("D=M\n");
-        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if get.
-        addASMOutput("D;JGE\n"); // If get, jump to code for get.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !get.
-        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the get code.
-        addASMOutput("0;JMP\n"); // Jump over the get code.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for get.
+        if (this->vStack.at(i).kind == D_VALUE)
+        {
+            addASMOutput(getSlotAddress(i) + "M=D\n");
+            this->vStack.at(i).kind = MEM_VALUE;
+        }
     }
-    else if (vm == "lt") // Less than
+    
+    return;
+ }
+ 
+/**
+ * Stores the values on vStack at their stack registers, and moves sp past them once.
+ * The top keep values are left on vStack (they will be consumed right after), the rest are removed.
+ *
+ * @param keep The number of values to leave on top of vStack.
+ */
+ void Translator::flushVStack(int keep)
+ {
+    int count = (int)this->vStack.size() - keep;
+    if (count <= 0)
+        return;
+    
+    // A single value in D can be pushed without going to *sp first:
+    if (count == 1 && keep == 0 && this->vStack.at(0).kind == D_VALUE)
     {
-        translateAL("sub");
-        addASMOutput("D=M\n");
-        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if lt.
-        addASMOutput("D;JLT\n"); // If lt, jump to code for lt.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !lt.
-        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the lt code.
-        addASMOutput("0;JMP\n"); // Jump over the lt code.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for lt.
+        addASMOutput("@" + getPointer("sp") + "\nAM=M+1\nA=A-1\nM=D\n"); // sp++, and store D at *(sp-1).
+        this->vStack.clear();
+        return;
     }
-    else if (vm == "gt") // Greater than
+    
+    // Any constant needing D would clobber a D_VALUE, so store that first:
+    bool needsD = count > 3;
+    for (int i = 0; i < count; i++)
     {
-        translateAL("sub");
-        addASMOutput("D=M\n");
-        addASMOutput("@" + std::to_string(this->asmLineNum + 7) + "\n"); // Set code address to jump to if gt.
-        addASMOutput("D;JGT\n"); // If gt, jump to code for gt.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=0\n"); // Set top stack value to 0 (false) for !gt.
-        addASMOutput("@" + std::to_string(this->asmLineNum + 5) + "\n"); // Set address to jump over the gt code.
-        addASMOutput("0;JMP\n"); // Jump over the gt code.
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\nM=-1\n"); // Set top stack value to -1 (true) for gt.
+        StackValue value = this->vStack.at(i);
+        if (value.kind == CONST_VALUE && (value.value < -1 || value.value > 1))
+            needsD = true;
     }
-    else if (vm == "and")
+    for (int i = 0; i < this->vStack.size(); i++)
     {
-        addASMOutput(this->getLastTwoVal + "\n"); // Get the top two values of the stack.
-        addASMOutput("M=D&M\n"); // Set register[*sp--] to the top two values "and"ed. 
+        if (this->vStack.at(i).kind == D_VALUE && (i < count || needsD))
+        {
+            addASMOutput(getSlotAddress(i) + "M=D\n");
+            this->vStack.at(i).kind = MEM_VALUE;
+        }
     }
-    else if (vm == "or")
+    
+    for (int i = 0; i < count; i++)
     {
-        addASMOutput(this->getLastTwoVal + "\n"); // Get the top two values of the stack.
-        addASMOutput("M=D|M\n"); // Set register[*sp--] to the top two values "or"ed. 
+        StackValue value = this->vStack.at(i);
+        if (value.kind != CONST_VALUE)
+            continue;
+        if (value.value >= -1 && value.value <= 1)
+            addASMOutput(getSlotAddress(i) + "M=" + std::to_string(value.value) + "\n");
+        else
+            addASMOutput(getConstToD(value.value) + "\n" + getSlotAddress(i) + "M=D\n");
     }
-    else if (vm == "not")
+    
+    // sp += count:
+    if (count <= 3)
     {
-        addASMOutput("@" + getPointer("sp") + "\n" + dereference + "-1\n"); // Go to the top value on the stack.
-        addASMOutput("M=!M\n"); // Set register[*sp--] to not itself (!M).
+        addASMOutput("@" + getPointer("sp") + "\n");
+        for (int i = 0; i < count; i++)
+            addASMOutput("M=M+1\n");
     }
+    else
+        addASMOutput("@" + std::to_string(count) + "\nD=A\n@" + getPointer("sp") + "\nM=D+M\n");
+    
+    this->vStack.erase(this->vStack.begin(), this->vStack.begin() + count);
+    
     return;
  }
  
 /**
- * Translates vm label commands.
- * A label is a marker in the code that can be returned to. It is used to reuse code.
- * If the label is the start of a function, the function name must be in the format: <VMFileName>.<FunctionName>.
+ * Gets asm code that goes to the stack register of vStack.at(slot), register[*sp + slot]. Only A is changed.
  *
- * @param labelName A string containing a label name.
- * @param isFunc A bool that says whether the label is intended to be a function or not.
+ * @param slot The index of the value in vStack.
+ * @return The asm code, '\n' terminated.
  */
- void Translator::translateLabel(string labelName, bool isFunc)
+ string Translator::getSlotAddress(int slot)
  {
-    transform(labelName.begin(), labelName.end(), labelName.begin(),::toupper);
-    if (isFunc)
-        addASMOutput("(" + labelName + ")\n");
-    else
-        addASMOutput("(" + this->fileName + "." + this->curFuncName + "$" + labelName + ")\n");
+    string output = "@" + getPointer("sp") + "\n" + dereference + "\n";
+    for (int i = 0; i < slot; i++)
+        output += "A=A+1\n";
+    
+    return output;
+ }
+ 
+/**
+ * Gets asm code that sets A to a constant, which may be negative. Only A is changed.
+ *
+ * @param value The constant, as a 16 bit signed value.
+ * @return The asm code, not '\n' terminated.
+ */
+ string Translator::getConstToA(int value)
+ {
+    if (value >= 0)
+        return "@" + std::to_string(value);
+    if (value == -32768) // -32768 can't be negated to fit in an A instruction.
+        return "@32767\nA=-A\nA=A-1";
+    return "@" + std::to_string(-value) + "\nA=-A";
+ }
+ 
+/**
+ * Gets asm code that sets D to a constant, which may be negative. A may be changed.
+ *
+ * @param value The constant, as a 16 bit signed value.
+ * @return The asm code, not '\n' terminated.
+ */
+ string Translator::getConstToD(int value)
+ {
+    if (value >= -1 && value <= 1)
+        return "D=" + std::to_string(value);
+    if (value < 0 && value != -32768)
+        return "@" + std::to_string(-value) + "\nD=-A";
+    return getConstToA(value) + "\nD=A";
+ }
+ 
+/**
+ * Adds a new profiling counter, and the asm code to increment it. D is not changed.
+ * Counters are placed one after another from the profile base address. They rely on RAM starting zeroed,
+ * and wrap around after 32767.
+ *
+ * @param name What the counter counts, for the profile map.
+ */
+ void Translator::addProfileCounter(string name)
+ {
+    int address = this->profileBase + this->counterNames.size();
+    this->counterNames.push_back(name);
+    addASMOutput("@" + std::to_string(address) + "\nM=M+1\n");
     return;
  }
  
- /**
- * Translates vm go-to commands. It can be conditional (if-goto) or unconditional (goto).
- * The condition is based off the value on the top of the stack (*sp--).
- * The goto refers to a label, which represents a point in the program. 
- * If the command is conditional, the sp is decremented to overwrite the condition value.
- * If the label is the start of a function, the function name must be in the format: <VMFileName>.<FunctionName>.
+/**
+ * Translates the mulconst and divconst pseudo commands, made by Optimizer from calls to Math.multiply and Math.divide.
+ * The top stack value x is replaced with x * c or x / c. A constant x on the virtual stack is folded.
  *
- * @param goToCom A vector<string> containing a go-to vm command.
- * @param isFunc A bool that says whether the label that we intend to go to is a function label or not.
+ * @param vm A vector<string> containing a mulconst or divconst command.
  */
- void Translator::translateGoTo(vector<string> goToCom, bool isFunc)
+ void Translator::translateConstArith(vector<string> vm)
  {
- // If the go to is a label, you need to add the prefix. If it is a function, you only need to add the fileName as a prefix.
-    transform(goToCom.at(1).begin(), goToCom.at(1).end(), goToCom.at(1).begin(),::toupper); // Make label name uppercase.
-    if (goToCom.at(0) == "goto")
+    int value = std::stoi(vm.at(1));
+    bool isMultiply = (vm.at(0) == "mulconst");
+    bool isVStack = this->options->isEnabled("vstack");
+    
+    if (isVStack && !this->vStack.empty() && this->vStack.back().kind == CONST_VALUE)
     {
-        if (!isFunc)
-            addASMOutput("@" + this->fileName + "." + this->curFuncName + "$" + goToCom.at(1) + "\n"); // Load the address for the label in question.
-        else 
-            addASMOutput("@" + goToCom.at(1) + "\n"); // Load the address for the label in question.
-        addASMOutput("0;JMP\n"); // Jump the code to the label.
+        int x = this->vStack.back().value;
+        this->vStack.back().value = isMultiply ? (short)(x * value) : x / value;
+        return;
     }
-    else // If the command is if-goto:
+    
+    // Get x into D:
+    if (isVStack)
+        vStackPopToD();
+    else
+        addASMOutput("@" + getPointer("sp") + "\nA=M-1\nD=M\n");
+    
+    if (isMultiply)
+        translateConstMultiply(value);
+    else
+        translateConstDivide(value);
+    
+    // Put the result back:
+    if (isVStack)
     {
-        addASMOutput("@" + getPointer("sp") + "\nM=M-1\n" + dereference + "\n"); // Go to *sp-- and decrement sp.
-        addASMOutput("D=M\n"); // Save the value of the top of the stack in D (it should be either true (-1) or false (0)).
-        if (!isFunc)
-            addASMOutput("@" + this->fileName + "." + this->curFuncName + "$" + goToCom.at(1) + "\n"); // Load the address for the label in question.
+        StackValue result;
+        result.kind = D_VALUE;
+        result.value = 0;
+        this->vStack.push_back(result);
+    }
+    else
+        addASMOutput("@" + getPointer("sp") + "\nA=M-1\nM=D\n");
+    
+    return;
+ }
+ 
+/**
+ * Translates the arrayload and arraystore pseudo commands, made by Optimizer from the Jack compiler's array access code.
+ * arrayload: The top two stack values a, i are replaced with *(a+i). that = a+i.
+ * arraystore: The top two stack values p, x are popped, and x is stored at *p. that = p, and temp 0 = x.
+ *
+ * @param vm A vector<string> containing an arrayload or arraystore command.
+ */
+ void Translator::translateArrayAccess(vector<string> vm)
+ {
+    string that = getPointer("that");
+    string temp = getExternalAddress("temp", "0");
+    bool isVStack = this->options->isEnabled("vstack");
+    
+    if (vm.at(0) == "arrayload")
+    {
+        // Get a+i into D:
+        if (isVStack)
+        {
+            vStackAL("add"); // Folds constants, and adds to whatever is already in D.
+            vStackPopToD();
+        }
         else
-            addASMOutput("@" + this->fileName + "." + goToCom.at(1) + "\n"); // Load the address for the label in question.
-        addASMOutput("D;JNE\n"); // Jump if D is true (-1; Jump if D != 0).
+            addASMOutput("@" + getPointer("sp") + "\nAM=M-1\nD=M\nA=A-1\nD=D+M\n"); // sp--, D = *sp + *(sp-1).
+        
+        addASMOutput("@" + that + "\nM=D\nA=D\nD=M\n");
+        
+        // Put the value back:
+        if (isVStack)
+        {
+            StackValue result;
+            result.kind = D_VALUE;
+            result.value = 0;
+            this->vStack.push_back(result);
+        }
+        else
+            addASMOutput("@" + getPointer("sp") + "\nA=M-1\nM=D\n");
+        
+        return;
+    }
+    
+    // Get x into D, and into temp 0:
+    if (isVStack)
+        vStackPopToD();
+    else
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\nD=M\n");
+    addASMOutput("@" + temp + "\nM=D\n");
+    
+    // Store x at p, then keep p in that. p is never a D_VALUE, as x was in D:
+    if (isVStack && !this->vStack.empty() && this->vStack.back().kind == CONST_VALUE)
+    {
+        int address = this->vStack.back().value;
+        addASMOutput(getConstToA(address) + "\nM=D\n" + getConstToD(address) + "\n@" + that + "\nM=D\n");
     }
+    else if (isVStack && !this->vStack.empty())
+        addASMOutput(getSlotAddress(this->vStack.size() - 1) + "A=M\nM=D\nD=A\n@" + that + "\nM=D\n");
+    else
+        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\nA=M\nM=D\nD=A\n@" + that + "\nM=D\n");
+    
+    if (isVStack && !this->vStack.empty())
+        this->vStack.pop_back();
     
     return;
  }
  
 /**
- * Translates the vm function command: function <functionName> <nVars>.
- * This command defines a function in the code to be reused. 
- * A function can take some arguments, have some local variables, and always returns one value.
- * <functionName> is the desired name of the function. This will be accessed via a label.
- * <nVars> specifies how many local variables this function has. They are initialized to 0.
+ * Multiplies D by a constant with shift-and-add, going through value's bits from the highest. D holds the result.
+ * R13 is used for doubling (Hack can't do D+D), and R14 keeps the original D.
  *
- * @param funcCom A vector<string> containing a function vm command.
+ * @param value The constant, 0 to 32767.
  */
- void Translator::translateFuncCom(vector<string> funcCom)
+ void Translator::translateConstMultiply(int value)
  {
-    this->curFuncName = funcCom.at(1);
-    output += createVMComment({"label", funcCom.at(1)}); // Add a comment for this command.
-    translateLabel(funcCom.at(1), true);
+    if (value == 0)
+    {
+        addASMOutput("D=0\n");
+        return;
+    }
     
-    for (int i = 0; i < std::stoi(funcCom.at(2)); i++)
-        translatePopPush({"push", "constant", "0"});
+    int highBit = 14;
+    while ((value >> highBit) == 0)
+        highBit--;
+    
+    if ((value & ((1 << highBit) - 1)) != 0) // Another bit besides the highest is set, so D will be added again.
+        addASMOutput("@R14\nM=D\n");
+    
+    for (int i = highBit - 1; i >= 0; i--)
+    {
+        addASMOutput("@R13\nM=D\nD=D+M\n"); // D = D * 2.
+        if ((value >> i) & 1)
+            addASMOutput("@R14\nD=D+M\n"); // D = D + x.
+    }
     
     return;
  }
  
 /**
- * Translates the vm function command: function <functionName> <nArgs>.
- * This command runs the pre-defined code in the function <functionName>.
- * <nArgs> specifies how many arguments <functionName> takes from the stack.
+ * Divides D by a power of 2, rounding toward 0 like Math.divide. D holds the result.
+ * Hack has no right shift, so the bits of |D| from bit 15 down to bit log2(value) are moved into the result one at a time:
+ * R13 is doubled each step, so the bit to move is always its sign. R14 builds the result, and R15 keeps the original D.
+ * Small powers of 2 leave many bits to move, so the steps are looped instead of unrolled (see isConstDivideLooped).
  *
- * @param callCom A vector<string> containing a call vm command.
+ * @param value The power of 2, 1 to 16384.
  */
- void Translator::translateCallCom(vector<string> callCom)
+ void Translator::translateConstDivide(int value)
  {
-    // Save return address, local, argument, this, that:
+    if (value == 1)
+        return;
     
-    // Push return address:
-    string returnAdd = "";
-    if (callCom.size() > 2) // Need to skip all the following call code for the return address.
-        returnAdd = std::to_string(this->asmLineNum + 47);
-    else
-        returnAdd = std::to_string(this->asmLineNum + 40); // Doesn't have to skip the conditional code for arguments.
-    output += createVMComment({"push", "constant", returnAdd}); // Add a comment for this command.
-    translatePopPush({"push", "constant", returnAdd});
+    int shift = 0;
+    while ((1 << shift) < value)
+        shift++;
     
-    // Push local, argument, this, and that pointers:
-    for (int i = 0; i < 4; i++)
+    addASMOutput("@R15\nM=D\n"); // Keep D for its sign.
+    addASMOutput("@" + std::to_string(this->asmLineNum + 3) + "\nD;JGE\nD=-D\n"); // D = |D|.
+    
+    if (isConstDivideLooped(value, this->options->isOptimizeForSize()))
     {
-        addASMOutput("@" + getPointer(this->STACK_BASE_NUMS.at(i+1).at(0)) + "\nD=M\n"); // Go to  pointer. Put M in D.
-        addASMOutput("@" + getPointer("sp") + "\nA=M\nM=D\n"); // Save  pointer value at *sp.
-        addASMOutput("@" + getPointer("sp") + "\nM=M+1\n"); // sp++.
+        // The result starts as a marker bit, that ends the loop once it is shifted past the 16 - shift result bits:
+        addASMOutput("@R13\nM=D\n@R14\nM=1\n");
+        int loopStart = this->asmLineNum;
+        addASMOutput("@R14\nD=M\nM=D+M\n"); // result = result * 2.
+        addASMOutput("@R13\nD=M\nM=D+M\n"); // D = the bits left, R13 = them shifted once.
+        addASMOutput("@" + std::to_string(this->asmLineNum + 4) + "\nD;JGE\n@R14\nM=M+1\n"); // If the bit is set, result++.
+        if (shift == 1) // The marker ends up as the sign bit.
+            addASMOutput("@R14\nD=M\n@" + std::to_string(loopStart) + "\nD;JGE\n@32767\nD=D&A\n");
+        else
+            addASMOutput("@R14\nD=M\n@" + std::to_string(1 << (16 - shift)) + "\nD=D-A\n@" + std::to_string(loopStart) + "\nD;JLT\n");
+        addASMOutput("@R14\nM=D\n"); // The result without the marker.
     }
-    
-    // Adjust argument segment pointer using callCom.at(3): 
-    if (callCom.size() > 2) // If the function has arguments.
+    else
     {
-        addASMOutput("@" + std::to_string(stoi(callCom.at(2)) + 5) + "\nD=A\n");
-        addASMOutput("@" + getPointer("sp") + "\nD=M-D\n");
-        addASMOutput("@" + getPointer("argument") + "\nM=D\n");
+        addASMOutput("@R13\nM=D\n@R14\nM=0\n");
         
-        // Adjust local segment to point to the upcoming local vars:
-        addASMOutput("@" + getPointer("sp") + "\n");
+        for (int i = 15; i >= shift; i--)
+        {
+            if (i != 15) // The result is still 0 for the first bit.
+                addASMOutput("@R14\nD=M\nM=D+M\n"); // result = result * 2.
+            addASMOutput("@R13\nD=M\nM=D+M\n"); // D = the bits left, R13 = them shifted once.
+            addASMOutput("@" + std::to_string(this->asmLineNum + 4) + "\nD;JGE\n@R14\nM=M+1\n"); // If the bit is set, result++.
+        }
     }
-    // count. 
-    addASMOutput("D=M\n"); // Don't need to get sp again since it's already the current address.
-    addASMOutput("@" + getPointer("local") + "\nM=D\n");
-    
-    // Go to function:
     
-    output += createVMComment({"goto", callCom.at(1)}); // Add a comment for this command.
-    translateGoTo({"goto", callCom.at(1)}, true);
+    addASMOutput("@R15\nD=M\n@" + std::to_string(this->asmLineNum + 6) + "\nD;JGE\n@R14\nM=-M\n"); // Negate for a negative D.
+    addASMOutput("@R14\nD=M\n");
     
     return;
  }
  
 /**
- * Translates the vm return command.
- * This command resets the stack, so that the function we are currently in returns a value to the stack instead of 
- * All it's processing that was previously on the stack. The return value will be located where the original first argument was.
- *
- * Previous states of the local, argument, this, and that pointers are saved on the stack relative to the current local pointer.
- * The saved that is at local - 1.
- * this is at local - 2.
- * argument is at local - 3.
- * local is at local - 4.
- * The return address is in local - 5.
+ * Gets the number of asm lines translateConstMultiply uses, so Optimizer can decide if inlining is worth it.
  *
- * The return value will be located at *sp--.
+ * @param value The constant, 0 to 32767.
+ * @return The number of asm lines.
  */
- void Translator::translateReturnCom()
+ int Translator::getConstMultiplySize(int value)
  {
-    // Save return value at R13:
-    addASMOutput("@" + getPointer("sp") + "\nA=M-1\nD=M\n"); // Put the return value in D.
-    addASMOutput("@R13\nM=D\n"); // Save D at R13 for now.
-    
-    // Save argument at R14; sp should be set here once return is finished.
-    addASMOutput("@" + getPointer("argument") + "\nD=M\n@R14\nM=D\n");
-    
-    // Set sp to current local:
-    addASMOutput("@" + getPointer("local") + "\nD=M\n@" + getPointer("sp") + "\nM=D\n"); // Set sp to local.
+    if (value == 0)
+        return 1;
     
-    //  Reset local, argument, this, and that:
-    for (int i = 0; i < 4; i++)
-    {
-        addASMOutput("@" + getPointer("sp") + "\nAM=M-1\n"); // Decrement and go to *sp.
-        addASMOutput("D=M\n"); // Get value of M into D. This is a saved value for resetting the pointers.
-        addASMOutput("@" + getPointer(this->STACK_BASE_NUMS.at(4-i).at(0)) + "\nM=D\n"); // Set the that pointer to this saved value.
-    }
+    int highBit = 14;
+    while ((value >> highBit) == 0)
+        highBit--;
     
-    // Save the return address at R15:
-    addASMOutput("@" + getPointer("sp") + "\nAM=M-1\n"); // Decrement and go to *sp.
-    addASMOutput("D=M\n"); // Put return address in D.
-    addASMOutput("@R15\nM=D\n"); // Store return address in R15 temporarily.
+    int setBits = 0;
+    for (int i = 0; i < highBit; i++)
+        setBits += (value >> i) & 1;
     
-    // Set sp to the value at R14:
-    addASMOutput("@R14\nD=M\n@" + getPointer("sp") + "\nM=D\n");
+    return (setBits > 0 ? 2 : 0) + 3 * highBit + 2 * setBits;
+ }
+ 
+/**
+ * Gets the number of asm lines translateConstDivide uses, so Optimizer can decide if inlining is worth it.
+ *
+ * @param value The power of 2, 1 to 16384.
+ * @param isOptimizeForSize True if the size goal is used, which picks the loop more often.
+ * @return The number of asm lines.
+ */
+ int Translator::getConstDivideSize(int value, bool isOptimizeForSize)
+ {
+    if (value == 1)
+        return 0;
     
-    // Push return value (R13):
-    addASMOutput("@R13\nD=M\n@" + getPointer("sp") + "\n" + dereference + "\nM=D\n");
-    addASMOutput("@" + getPointer("sp") + "\n" + "M=M+1\n"); // sp++
+    int shift = 0;
+    while ((1 << shift) < value)
+        shift++;
     
+    return isConstDivideLooped(value, isOptimizeForSize) ? 35 : 10 * (16 - shift) + 14;
+ }
+ 
+/**
+ * Checks if translateConstDivide loops over the bits instead of unrolling them. The loop is 35 asm lines for any power of 2,
+ * while the unrolled steps take 10 lines per result bit but run about 6 fewer instructions each.
+ * The loop is used when it is smaller, unless optimizing for speed and the unrolled code is within MAX_UNROLLED_DIVIDE.
+ *
+ * @param value The power of 2, 2 to 16384.
+ * @param isOptimizeForSize True if the size goal is used.
+ * @return True if the loop is used.
+ */
+ bool Translator::isConstDivideLooped(int value, bool isOptimizeForSize)
+ {
+    int shift = 0;
+    while ((1 << shift) < value)
+        shift++;
     
-    // Jump to return address at R15:
-    addASMOutput("@R15\nA=M\n"); // Go to *R15.
-    addASMOutput("0;JMP\n"); // Jump.
-    return;
+    int unrolledSize = 10 * (16 - shift) + 14;
+    if (unrolledSize <= 35)
+        return false;
+    return isOptimizeForSize || unrolledSize > MAX_UNROLLED_DIVIDE;
  }
  
 /**
@@ -573,78 +3007,298 @@ string Translator::createVMComment(vector<string> vm)
  }
  
 /**
- * Initializes premade asm code, such as the code to get the top two values off the stack.
- * *Not* terminated with a \n, more asm code may be added on to last command.
+ * Gets the pointers that a call to funcName saves in its frame.
+ * Without an Analyzer, or the "frames" pass, every frame is the standard one.
+ *
+ * @param funcName The name of the function being called or returned from.
+ * @return A vector<string> of pointer names, in the order they are pushed on the stack.
+ */
+ vector<string> Translator::getSavedPointers(string funcName)
+ {
+    if (this->analyzer == NULL || !this->options->isEnabled("frames"))
+        return {"local", "argument", "this", "that"};
+    return this->analyzer->getSavedPointers(funcName);
+ }
+ 
+/**
+ * Initializes premade asm code, such as the code to get the top two values off the stack.
+ * *Not* terminated with a \n, more asm code may be added on to last command.
+ */
+ void Translator::initializePremadeASM()
+ {
+    this->dereference = "A=M"; 
+    this->getLastTwoVal = "@" + getPointer("sp") + "\nM=M-1\n" + dereference + "\nD=M\nA=A-1"; // Gets top two values from the stack. The top into D, the second into M. sp--.
+ }
+ 
+/**
+ * Adds asm code to this->output.
+ * Keeps track of current asm line number in this->asmLineNum.
+ * Forgets the address A is at; Callers that know it set knownSegment and knownIndex after adding their code.
+ * 
+ * @param input A string of the asm code you wish to add to this->output.
+ */
+ void Translator::addASMOutput(string input)
+ {
+    this->knownSegment = ""; // Whatever A was at, this code may change it.
+
+    if (input[0] != '(') // Label declarations are not included in the final machine code. Thus, they should not add to the line number.
+    {
+        int lines = std::count(input.begin(), input.end(), '\n');
+        this->asmLineNum += lines; // Keep track of what the current asm line is.
+        
+        // Charge the lines to the current function, file, and vm command for the size report:
+        this->funcSizes[this->curFuncName == "" ? "(top level)" : this->curFuncName] += lines;
+        this->fileSizes[this->fileName] += lines;
+        this->categorySizes[this->curCategory] += lines;
+    }
+    
+    output += input;
+    if (this->writer != NULL && output.length() >= OutputWriter::BLOCK_SIZE)
+        this->writer->write(&output);
+    return;
+ }
+
+/**
+ * Sets where the output is written, in blocks, as it is translated. Output added without one is kept until the next is set.
+ *
+ * @param writer The OutputWriter, already open.
+ */
+ void Translator::setWriter(OutputWriter* writer)
+ {
+    this->writer = writer;
+    
+    return;
+ }
+ 
+/**
+ * Hands the output not yet written over to the writer, I.E. once translation is done.
+ */
+ void Translator::flushOutput()
+ {
+    if (this->writer != NULL && !output.empty())
+        this->writer->write(&output);
+    
+    return;
+ }
+ 
+/**
+ * Sets the Analyzer used to pick the frame layout for each function.
+ * It must have already analyzed the input that will be translated.
+ *
+ * @param analyzer A pointer to the Analyzer, or NULL to always use the standard frame.
+ */
+ void Translator::setAnalyzer(Analyzer* analyzer)
+ {
+    this->analyzer = analyzer;
+    return;
+ }
+ 
+/**
+ * Sets the code generation options.
+ *
+ * @param options A pointer to the Options; which passes to run, and whether to prefer size or speed.
+ */
+ void Translator::setOptions(Options* options)
+ {
+    this->options = options;
+    return;
+ }
+ 
+/**
+ * Adds a comment to the top of the output recording the options it was translated with.
+ */
+ void Translator::addHeader()
+ {
+    output += "// Translated by VMTranslator " + this->options->getDescription() + "\n";
+    return;
+ }
+ 
+/**
+ * Adds asm initialization code, required for every hack program.
+ */
+ void Translator::addInitCode()
+ {    
+    this->curCategory = "bootstrap";
+    this->fileName = "Sys.vm";
+    
+    // Set sp to 256:
+    addASMOutput("@256\nD=A\n@" + getPointer("sp") + "\nM=D\n");
+    
+    // Call Sys.init:
+    vector<string> temp = {"call", "Sys.init"};
+    output += createVMComment(temp); // Add a comment for this command.
+    translateVMCom(temp);
+ }
+ 
+ /**
+ * Translates the vm program, parsed by the Parser, into this->output (a string) as an asm program,
+ * Complete with comments.
+ * Requires input to be parsed by Parser.
+ *
+ * @param input The pointer to the 2D string vector that is the parsed input. It MUST have been parsed with Parser.
+ * @param fileName The name of the vm file we are translating.
+ */
+void Translator::translateInput(vector<vector<string>> input)
+{
+    vector<string> curCom;
+    
+    // Without a base given, the counters end right under the screen, so the heap only loses as many registers as there are counters.
+    this->profileBase = this->options->getProfileBase();
+    if (this->profileBase == 0)
+    {
+        int counters = 0;
+        for (int i = 0; i < input.size(); i++)
+        {
+            if ((input.at(i).at(0) == "function" && this->options->getInstrument() >= 1) || (input.at(i).at(0) == "label" && this->options->getInstrument() >= 2))
+                counters++;
+        }
+        this->profileBase = SCREEN_BASE - counters;
+    }
+
+    for (int i = 0; i < input.size(); i++)
+    {
+        curCom = input.at(i);
+        this->curCategory = curCom.at(0);
+        if (curCom.at(0) == "push" || curCom.at(0) == "pop")
+            this->curCategory += " " + curCom.at(1);
+        
+        // Add a comment in output preceding the asm translation that says the vm code to be translated.
+        output += createVMComment(curCom);
+        
+        // Translate the current VM Command.
+        translateVMCom(curCom);
+    }
+    
+    flushVStack(0); // Anything left on the virtual stack belongs on the real stack.
+    
+    return;
+}
+ 
+/**
+ * Gets the number of ROM words the output uses so far.
+ *
+ * @return The asm line count, not including labels and comments.
+ */
+ int Translator::getROMSize()
+ {
+    return this->asmLineNum;
+ }
+ 
+/**
+ * Gets the number of ROM words a function's code uses so far.
+ *
+ * @param funcName The name of the function.
+ * @return The asm line count of the function, 0 if it has no code.
+ */
+ int Translator::getFunctionSize(string funcName)
+ {
+    map<string, int>::iterator it = this->funcSizes.find(funcName);
+    if (it == this->funcSizes.end())
+        return 0;
+    return it->second;
+ }
+ 
+/**
+ * Creates a report of the ROM words used by each function, vm file, and vm command category.
+ * Each table is sorted from largest to smallest, so the functions worth shrinking are at the top.
+ *
+ * @return The report as a string.
+ */
+ string Translator::getSizeReport()
+ {
+    string output = "ROM usage: " + std::to_string(this->asmLineNum) + " / " + std::to_string(ROM_SIZE) + " words\n";
+    if (this->asmLineNum > ROM_SIZE)
+        output += "Over the ROM limit by " + std::to_string(this->asmLineNum - ROM_SIZE) + " words!\n";
+    
+    output += getSizeTable("Functions", &this->funcSizes);
+    output += getSizeTable("Files", &this->fileSizes);
+    output += getSizeTable("VM commands", &this->categorySizes);
+    
+    return output;
+ }
+ 
+/**
+ * Creates the size baseline of the output: the total asm lines, and the asm lines used by each vm command category.
+ * One "<size> <name>" line each, I.E. "56 pop that". The total is named "total".
+ *
+ * @return The baseline as a string.
+ */
+ string Translator::getSizeBaseline()
+ {
+    string output = std::to_string(this->asmLineNum) + " total\n";
+    for (map<string, int>::iterator it = this->categorySizes.begin(); it != this->categorySizes.end(); it++)
+    {
+        if (it->first != "")
+            output += std::to_string(it->second) + " " + it->first + "\n";
+    }
+    
+    return output;
+ }
+ 
+/**
+ * Creates the map of profiling counter addresses to what they count, one "<address> <name>" line each,
+ * after a comment line saying how many heap registers the counters take.
+ * Reading those addresses from a RAM dump after a run gives the profile.
+ *
+ * @return The map as a string.
  */
- void Translator::initializePremadeASM()
+ string Translator::getProfileMap()
  {
-    this->dereference = "A=M"; 
-    this->getLastTwoVal = "@" + getPointer("sp") + "\nM=M-1\n" + dereference + "\nD=M\nA=A-1"; // Gets top two values from the stack. The top into D, the second into M. sp--.
+    string output = "// The heap shrinks by " + std::to_string(this->counterNames.size()) + " words: Memory.alloc must not hand out RAM["
+        + std::to_string(this->profileBase) + ".." + std::to_string(this->profileBase + (int)this->counterNames.size() - 1) + "].\n";
+    for (int i = 0; i < this->counterNames.size(); i++)
+        output += std::to_string(this->profileBase + i) + " " + this->counterNames.at(i) + "\n";
+    
+    return output;
  }
  
 /**
- * Adds asm code to this->output.
- * Keeps track of current asm line number in this->asmLineNum.
- * 
- * @param input A string of the asm code you wish to add to this->output.
+ * Gets the RAM address of the first profiling counter.
+ *
+ * @return The address.
  */
- void Translator::addASMOutput(string input)
+ int Translator::getProfileBase()
  {
-    if (input[0] != '(') // Label declarations are not included in the final machine code. Thus, they should not add to the line number.
-        this->asmLineNum += std::count(input.begin(), input.end(), '\n'); // Keep track of what the current asm line is.
-    
-    output += input;
-    return;
+    return this->profileBase;
  }
-
+ 
 /**
- * Adds asm initialization code, required for every hack program.
+ * Gets the RAM address right after the last profiling counter.
+ *
+ * @return The address.
  */
- void Translator::addInitCode()
- {    
-    // Set sp to 256:
-    addASMOutput("@256\nD=A\n@" + getPointer("sp") + "\nM=D\n");
-    
-    // Call Sys.init:
-    this->fileName = "Sys.vm";
-    vector<string> temp = {"call", "Sys.init"};
-    output += createVMComment(temp); // Add a comment for this command.
-    translateVMCom(temp);
+ int Translator::getProfileEnd()
+ {
+    return this->profileBase + this->counterNames.size();
  }
  
- /**
- * Translates the vm program, parsed by the Parser, into this->output (a string) as an asm program,
- * Complete with comments.
- * Requires input to be parsed by Parser.
+/**
+ * Creates one table of the size report, sorted by size (largest first) and then by name.
  *
- * @param input The pointer to the 2D string vector that is the parsed input. It MUST have been parsed with Parser.
- * @param fileName The name of the vm file we are translating.
+ * @param title The title of the table.
+ * @param sizes A pointer to the map of names to their size in ROM words.
+ * @return The table as a string, with one "<size> <percent>% <name>" row per entry.
  */
-void Translator::translateInput(vector<vector<string>> input)
-{
-    vector<string> curCom;
-
-    for (int i = 0; i < input.size(); i++)
+ string Translator::getSizeTable(string title, map<string, int>* sizes)
+ {
+    vector<pair<int, string>> rows;
+    for (map<string, int>::iterator it = sizes->begin(); it != sizes->end(); it++)
+        rows.push_back(make_pair(-it->second, it->first)); // Negated so sort puts the largest first.
+    sort(rows.begin(), rows.end());
+    
+    string output = "\n" + title + ":\n";
+    for (int i = 0; i < rows.size(); i++)
     {
-        curCom = input.at(i);
-        
-        // Add a comment in output preceding the asm translation that says the vm code to be translated.
-        output += createVMComment(curCom);
+        string size = std::to_string(-rows.at(i).first);
+        string percent = std::to_string(this->asmLineNum == 0 ? 0 : (-rows.at(i).first * 1000 / this->asmLineNum));
+        percent = (percent.length() < 2 ? "0" : "") + percent; // Tenths of a percent, I.E. "0.5".
+        percent = percent.substr(0, percent.length() - 1) + "." + percent.substr(percent.length() - 1);
         
-        // Translate the current VM Command.
-        translateVMCom(curCom);
+        output += string(size.length() < 8 ? 8 - size.length() : 0, ' ') + size;
+        output += string(percent.length() < 7 ? 7 - percent.length() : 0, ' ') + percent + "%  ";
+        output += rows.at(i).second + "\n";
     }
     
-    return;
-}
- 
-/**
- * Gets the output of the interpretation.
- *
- * @return The interpreted output as a NULL terminated string.
- */
- string Translator::getOutput()
- {
     return output;
  }
  
@@ -657,6 +3311,8 @@ VMTranslator::VMTranslator()
 {
     translator = new Translator();
     parser = new Parser();
+    optimizer = new Optimizer();
+    analyzer = new Analyzer();
     this->input = "";
     return;
 }
@@ -666,15 +3322,18 @@ VMTranslator::VMTranslator()
  * Outputs this new .asm file with the same name into the same directory.
  * If path is a directory, then all .vm files will be translated into a .asm file with the directory's name.
  *
+ * @param path The path to a .vm file or directory of .vm files.
+ * @param options The code generation options to translate with.
  * @return 0 if file at path was loaded successfully, 1 if not.
  */
- int VMTranslator::translate(char* path)
+ int VMTranslator::translate(char* path, Options* options)
  {
     // Go through dir, find a vm file, and then add it to this->input:
     string pathS = string(path); // Get input path.
     string outputFileName = pathS.substr(pathS.find_last_of("\\") + 1); // Set the name for the output .asm file.
 
     bool isDir = isDirectory(&pathS);
+    vector<vector<string>> irOutput; // Commands loaded from .vmir files, already parsed.
     
     if (isDir)
     {
@@ -698,12 +3357,27 @@ VMTranslator::VMTranslator()
                 loadInput(&temp);
         }
         
+        // A .vmir file is only used when there is no .vm file it could be out of date with:
+        for (int i = 0; i < files.size(); i++)
+        {
+            temp = files.at(i).path().string();
+            if (getFileExtention(temp) != "vmir" || std::count(this->inputPaths.begin(), this->inputPaths.end(), temp.substr(0, temp.length() - 2)) > 0)
+                continue;
+            if (loadIR(&temp, &irOutput) != 0)
+                return 1;
+        }
     }
     else
     {
-        loadInput(&pathS);
+        if (getFileExtention(pathS) == "vmir")
+        {
+            if (loadIR(&pathS, &irOutput) != 0)
+                return 1;
+        }
+        else
+            loadInput(&pathS);
         
-        outputFileName = outputFileName.substr(0, outputFileName.length() - 3);
+        outputFileName = outputFileName.substr(0, outputFileName.find_last_of("."));
         
         // Remove the file name from pathS:
         pathS = pathS.substr(0, pathS.find_last_of("\\"));
@@ -711,31 +3385,210 @@ VMTranslator::VMTranslator()
     this->input.append(1, '\0'); // Add NULL terminating char.
     
     
+    // Logic:
+    parser->parseInput(&input, options->getJobs()); // Parse commands.
+    
+    vector<vector<string>> parsedOutput = parser->getOutput();
+    
+    if (options->isEmitIR())
+    {
+        // Each .vm file starts with its newfile command, so split the commands there:
+        int fileNum = -1;
+        vector<vector<string>> fileCommands;
+        for (int i = 0; i <= parsedOutput.size(); i++)
+        {
+            if (i < parsedOutput.size() && parsedOutput.at(i).at(0) != "newfile")
+            {
+                fileCommands.push_back(parsedOutput.at(i));
+                continue;
+            }
+            if (fileNum >= 0 && writeIR(this->inputPaths.at(fileNum) + "ir", fileCommands) != 0)
+                return 1;
+            fileNum++;
+            fileCommands.clear();
+            if (i < parsedOutput.size())
+                fileCommands.push_back(parsedOutput.at(i));
+        }
+    }
+    parsedOutput.insert(parsedOutput.end(), irOutput.begin(), irOutput.end());
+    
+    optimizer->optimizeInput(&parsedOutput, options);
+    
+    // Only a directory is a whole program; a single file may have its functions called by code we never see.
+    analyzer->analyzeInput(parsedOutput, isDir);
+    translator->setAnalyzer(analyzer);
+    translator->setOptions(options);
+    
+    // The output is written as it is translated:
+    string basePath = pathS + "\\" + outputFileName;
+    OutputWriter writer;
+    if (writer.open(basePath + ".asm", !options->isDirectWrite()) != 0)
+        return 1;
+    translator->setWriter(&writer);
+    
+    translator->addHeader();
+    
     if (isDir)
     {
         // Add init code:
         translator->addInitCode();
     }
-
     
-    // Logic:
-    parser->parseInput(&input); // Parse commands.
+    translator->translateInput(parsedOutput); // Translate.
     
-    vector<vector<string>> parsedOutput = parser->getOutput();
+    translator->flushOutput();
+    translator->setWriter(NULL);
+    if (writer.close() != 0)
+    {
+        cout << "Can't write " << basePath << ".asm!\n";
+        return 1;
+    }
     
-    translator->translateInput(parsedOutput); // Translate.
+    if (options->isStats())
+    {
+        cout << optimizer->getStats();
+        
+        // A folded function saves as much ROM as the function it shares code with uses.
+        int romSaved = 0;
+        map<string, string> foldedFunctions = optimizer->getFoldedFunctions();
+        for (map<string, string>::iterator it = foldedFunctions.begin(); it != foldedFunctions.end(); it++)
+            romSaved += translator->getFunctionSize(it->second);
+        if (romSaved > 0)
+            cout << "ROM saved by folding: " << romSaved << " words\n";
+    }
     
-    string transOutput = translator->getOutput();
     
+    // The counters have to stay in the heap: Under it are the statics and the stack, over it the screen.
+    if (options->getInstrument() > 0 && (translator->getProfileBase() < Translator::HEAP_BASE || translator->getProfileEnd() > Translator::SCREEN_BASE))
+    {
+        cout << "The profiling counters need RAM[" << translator->getProfileBase() << ".." << translator->getProfileEnd() - 1 << "], ";
+        cout << "past the heap at RAM[" << Translator::HEAP_BASE << ".." << Translator::SCREEN_BASE - 1 << "]! Use a lower --profile-base.\n";
+        std::error_code removeError;
+        std::experimental::filesystem::remove(basePath + ".asm", removeError);
+        return 1;
+    }
     
     //Output:
-    pathS = pathS + "\\" + outputFileName + ".asm"; // Change file extension to asm.
     ofstream outputFile;
-    outputFile.open(pathS, ios::out);
-    outputFile << transOutput;
-    outputFile.close();
     
-    return 0;
+    int error = 0;
+    if (options->getSizeBaseline() != "")
+        error = checkSizeBaseline(options);
+    
+    if (options->getInstrument() > 0)
+    {
+        outputFile.open(basePath + ".prof", ios::out);
+        outputFile << translator->getProfileMap();
+        outputFile.close();
+    }
+    
+    if (options->isSizeReport())
+    {
+        outputFile.open(basePath + ".size", ios::out);
+        outputFile << translator->getSizeReport();
+        outputFile.close();
+    }
+    
+    // The assembler would only find this out later; Check it here so we know which functions to shrink.
+    // The size is only known once the asm is streamed out, so an output that doesn't fit is deleted rather than left to be assembled.
+    if (translator->getROMSize() > Translator::ROM_SIZE)
+    {
+        cout << "Output is " << translator->getROMSize() << " words, the hack ROM only has " << Translator::ROM_SIZE << "! ";
+        cout << "Use --size-report to see what to shrink.\n";
+        if (!options->isROMWarnOnly())
+        {
+            std::error_code removeError;
+            std::experimental::filesystem::remove(basePath + ".asm", removeError);
+            return 1;
+        }
+    }
+    
+    return error;
+ }
+ 
+/**
+ * Compares the asm line counts of the output to the size baseline file, so growth from a code generation change
+ * is seen right away. With --record-baseline the current counts are written to the file instead, to record a
+ * new baseline after an intended change. A missing baseline is an error, so a mistyped path can't pass.
+ *
+ * @param options The code generation options, with the baseline path and tolerance.
+ * @return 0 if nothing grew past the tolerance, 1 if something did or there is no baseline.
+ */
+ int VMTranslator::checkSizeBaseline(Options* options)
+ {
+    string current = translator->getSizeBaseline();
+    
+    if (options->isRecordBaseline())
+    {
+        ofstream outputFile;
+        outputFile.open(options->getSizeBaseline(), ios::out);
+        if (!outputFile.is_open())
+        {
+            cout << "Can't write " << options->getSizeBaseline() << "!\n";
+            return 1;
+        }
+        outputFile << current;
+        outputFile.close();
+        cout << "Recorded size baseline " << options->getSizeBaseline() << "\n";
+        return 0;
+    }
+    
+    ifstream baselineFile;
+    baselineFile.open(options->getSizeBaseline(), ios::in);
+    if (!baselineFile.is_open())
+    {
+        cout << "No size baseline at " << options->getSizeBaseline() << "! Use --record-baseline to record one.\n";
+        return 1;
+    }
+    
+    string baseline = "";
+    string temp;
+    while (std::getline(baselineFile, temp))
+        baseline += temp + "\n";
+    baselineFile.close();
+    
+    map<string, int> baselineSizes = parseSizeBaseline(baseline);
+    map<string, int> currentSizes = parseSizeBaseline(current);
+    
+    int error = 0;
+    for (map<string, int>::iterator it = currentSizes.begin(); it != currentSizes.end(); it++)
+    {
+        int oldSize = baselineSizes[it->first]; // 0 if the category is new.
+        if (it->second * 100 > oldSize * (100 + options->getSizeTolerance()))
+        {
+            cout << "Size regression: " << it->first << " went from " << oldSize << " to " << it->second << " words\n";
+            error = 1;
+        }
+    }
+    
+    return error;
+ }
+ 
+/**
+ * Parses a size baseline, as created by Translator::getSizeBaseline.
+ *
+ * @param input The baseline as a string.
+ * @return A map of each name in the baseline to its size.
+ */
+ map<string, int> VMTranslator::parseSizeBaseline(string input)
+ {
+    map<string, int> output;
+    int start = 0;
+    while (start < input.length())
+    {
+        int end = input.find('\n', start);
+        if (end == string::npos)
+            end = input.length();
+        
+        string line = input.substr(start, end - start);
+        int space = line.find(' ');
+        if (space != string::npos && space > 0 && line.find_first_not_of("0123456789") == space)
+            output[line.substr(space + 1)] = std::stoi(line.substr(0, space));
+        
+        start = end + 1;
+    }
+    
+    return output;
  }
  
  /**
@@ -746,6 +3599,7 @@ VMTranslator::VMTranslator()
  */
  int VMTranslator::loadInput(string* path)
  {
+    this->inputPaths.push_back(*path);
     input.append("newfile " + path->substr(path->find_last_of("\\") + 1, path->length() - 3) + "\n"); // Tell the translator what file this is.
     
     ifstream vmFile;
@@ -767,6 +3621,238 @@ VMTranslator::VMTranslator()
     return 0;
  }
  
+/**
+ * Loads a .vmir file, as written by writeIR, and adds its commands to output.
+ * The file is read in one go, and the commands are built straight from its symbols.
+ *
+ * @param path The path to the .vmir file.
+ * @param output A pointer to the 2D string vector the commands are added to.
+ * @return 0 if the file was loaded, 1 if it couldn't be opened or isn't valid.
+ */
+ int VMTranslator::loadIR(string* path, vector<vector<string>>* output)
+ {
+    ifstream irFile;
+    irFile.open(path->c_str(), ios::in | ios::binary);
+    if (!irFile.is_open())
+    {
+        cout << "Path invalid; Usage: vmtranslator (path to .vm file/directory)\n";
+        return 1;
+    }
+    
+    irFile.seekg(0, ios::end);
+    std::streamoff length = irFile.tellg();
+    if (length < 0) // The size couldn't be found, I.E. not a regular file.
+    {
+        cout << *path << " is cut short or corrupt!\n";
+        return 1;
+    }
+    string buffer(length, '\0');
+    irFile.seekg(0, ios::beg);
+    irFile.read(&buffer[0], buffer.length());
+    if (irFile.gcount() != length)
+    {
+        cout << *path << " is cut short or corrupt!\n";
+        return 1;
+    }
+    irFile.close();
+    
+    // Check the header, and that every section is in the file:
+    if (buffer.length() < 20 || buffer.substr(0, 4) != "VMIR" || readIRWord(&buffer, 4) != IR_VERSION)
+    {
+        cout << *path << " is not a version " << IR_VERSION << " .vmir file!\n";
+        return 1;
+    }
+    size_t symbolCount = readIRWord(&buffer, 8);
+    size_t symbolBytes = readIRWord(&buffer, 12);
+    size_t commandCount = readIRWord(&buffer, 16);
+    size_t symbolStart = 20;
+    size_t commandStart = symbolStart + symbolBytes;
+    if (symbolCount > buffer.length() || symbolBytes > buffer.length() || commandCount > buffer.length()
+        || commandStart + 2 * commandCount > buffer.length()) // Every command takes at least 2 bytes.
+    {
+        cout << *path << " is cut short or corrupt!\n";
+        return 1;
+    }
+    
+    vector<string> symbols;
+    size_t start = symbolStart;
+    for (size_t i = 0; i < symbolCount; i++)
+    {
+        size_t end = buffer.find('\0', start);
+        if (end >= commandStart)
+        {
+            cout << *path << " is cut short or corrupt!\n";
+            return 1;
+        }
+        symbols.push_back(buffer.substr(start, end - start));
+        start = end + 1;
+    }
+    if (start != commandStart) // Left over symbol bytes.
+    {
+        cout << *path << " is cut short or corrupt!\n";
+        return 1;
+    }
+    
+    size_t offset = commandStart;
+    for (size_t i = 0; i < commandCount; i++)
+    {
+        uint32_t elementCount;
+        if (!readIRVarint(&buffer, &offset, &elementCount) || elementCount == 0 || elementCount > IR_MAX_ELEMENTS)
+        {
+            cout << *path << " is cut short or corrupt!\n";
+            return 1;
+        }
+        
+        vector<string> command;
+        for (uint32_t j = 0; j < elementCount; j++)
+        {
+            uint32_t symbol;
+            if (!readIRVarint(&buffer, &offset, &symbol) || symbol >= symbols.size())
+            {
+                cout << *path << " is cut short or corrupt!\n";
+                return 1;
+            }
+            command.push_back(symbols.at(symbol));
+        }
+        output->push_back(command);
+    }
+    
+    if (offset != buffer.length()) // Left over bytes.
+    {
+        cout << *path << " is cut short or corrupt!\n";
+        return 1;
+    }
+    
+    return 0;
+ }
+ 
+/**
+ * Writes parsed commands to a .vmir file, that loadIR can load without parsing.
+ *
+ * @param path The path to write the .vmir file to.
+ * @param commands The parsed commands of one .vm file, starting with its newfile command.
+ * @return 0 if the file was written, 1 if a command has too many elements or the file couldn't be opened.
+ */
+ int VMTranslator::writeIR(string path, vector<vector<string>> commands)
+ {
+    // Number every distinct element, in the order they are first used:
+    map<string, uint32_t> symbolNums;
+    string symbolData = "";
+    string commandData = "";
+    for (int i = 0; i < commands.size(); i++)
+    {
+        if (commands.at(i).size() > IR_MAX_ELEMENTS)
+        {
+            cout << "Can't write " << path << ", " << commands.at(i).at(0) << " has more than " << IR_MAX_ELEMENTS << " elements!\n";
+            return 1;
+        }
+        
+        appendIRVarint(&commandData, commands.at(i).size());
+        for (int j = 0; j < commands.at(i).size(); j++)
+        {
+            string element = commands.at(i).at(j);
+            if (symbolNums.find(element) == symbolNums.end())
+            {
+                uint32_t symbolNum = symbolNums.size();
+                symbolNums[element] = symbolNum;
+                symbolData += element + '\0';
+            }
+            appendIRVarint(&commandData, symbolNums[element]);
+        }
+    }
+    string header = "VMIR";
+    appendIRWord(&header, IR_VERSION);
+    appendIRWord(&header, symbolNums.size());
+    appendIRWord(&header, symbolData.length());
+    appendIRWord(&header, commands.size());
+    
+    ofstream irFile;
+    irFile.open(path, ios::out | ios::binary);
+    if (!irFile.is_open())
+    {
+        cout << "Can't write " << path << "!\n";
+        return 1;
+    }
+    irFile << header << symbolData << commandData;
+    irFile.close();
+    
+    return 0;
+ }
+ 
+/**
+ * Adds a 32 bit little endian word to a .vmir buffer.
+ *
+ * @param buffer A pointer to the buffer.
+ * @param value The word.
+ */
+ void VMTranslator::appendIRWord(string* buffer, uint32_t value)
+ {
+    for (int i = 0; i < 4; i++)
+        buffer->append(1, (char)((value >> (8 * i)) & 0xFF));
+    
+    return;
+ }
+ 
+/**
+ * Reads a 32 bit little endian word from a .vmir buffer.
+ *
+ * @param buffer A pointer to the buffer.
+ * @param offset Where the word starts. The 4 bytes must be in buffer.
+ * @return The word.
+ */
+ uint32_t VMTranslator::readIRWord(string* buffer, size_t offset)
+ {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--)
+        value = (value << 8) | (unsigned char)buffer->at(offset + i);
+    
+    return value;
+ }
+ 
+/**
+ * Adds a varint to a .vmir buffer: 7 bits per byte, low bits first, with the high bit set on every byte but the last.
+ *
+ * @param buffer A pointer to the buffer.
+ * @param value The value.
+ */
+ void VMTranslator::appendIRVarint(string* buffer, uint32_t value)
+ {
+    while (value >= 0x80)
+    {
+        buffer->append(1, (char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer->append(1, (char)value);
+    
+    return;
+ }
+ 
+/**
+ * Reads a varint, as written by appendIRVarint, from a .vmir buffer.
+ *
+ * @param buffer A pointer to the buffer.
+ * @param offset A pointer to where the varint starts. It is moved past the varint.
+ * @param value A pointer to the value read.
+ * @return False if the varint runs past the buffer or is longer than 32 bits.
+ */
+ bool VMTranslator::readIRVarint(string* buffer, size_t* offset, uint32_t* value)
+ {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (*offset >= buffer->length())
+            return false;
+        
+        unsigned char byte = buffer->at(*offset);
+        (*offset)++;
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    
+    return false;
+ }
+ 
 /**
  * Takes input, starts at start, and returns a string with the value to offset the received string and \n char.
  * The string is a substring of *input. It is the characters from *input[start] till a \n char.
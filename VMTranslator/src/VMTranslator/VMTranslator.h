@@ -13,52 +13,278 @@
 #define VMTRANSLATOR_H
 
 #include <cstdlib>
+#include <cstdint>
 #include <string>
 #include <vector>
+#include <map>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 using namespace std;
 
+class Options;
 class Parser;
+class Optimizer;
+class Analyzer;
+class OutputWriter;
 class Translator;
 class VMTranslator;
 
+/**
+ * Code generation options: an optimization level (-O0, -O1, -O2, -Os), the size/speed goal, and which passes run.
+ * Every optimization is a named pass that the level turns on, and that can be toggled on its own with
+ * -f<pass> or -fno-<pass>, so any miscompile can be bisected to a single pass.
+ */
+class Options
+{
+private:
+    // Every pass name, with the lowest level that enables it.
+    const vector<vector<string>> PASSES = {{"frames", "1"}, {"locals", "1"}, {"vstack", "2"}, {"fold", "1"}, {"strength", "2"}, {"select", "1"}, {"arrays", "1"}, {"jumps", "1"}, {"static", "2"}};
+    
+    string level; // "0", "1", "2", or "s".
+    map<string, bool> enabled;
+    map<string, bool> toggles; // The -f<pass> and -fno-<pass> choices, which win over the level.
+    bool sizeReport; // Write a .size report of the asm lines used per function, file, and vm command.
+    bool romWarnOnly; // Only warn, instead of failing, when the output doesn't fit in ROM.
+    bool stats; // Print what the optimization passes changed.
+    bool emitIR; // Write a .vmir file of the parsed commands next to each .vm file.
+    bool directWrite; // Write the output on the translating thread, instead of a background one.
+    int instrument; // Profiling counters to add: 0 for none, 1 for function entries, 2 for function entries and labels.
+    int profileBase; // RAM address of the first profiling counter.
+    string sizeBaseline; // Path of the file of asm line counts to record or compare against. Empty for none.
+    bool recordBaseline; // Write sizeBaseline with the current counts, instead of comparing against it.
+    int sizeTolerance; // Percent the asm line counts may grow past sizeBaseline before it is a regression.
+    int jobs; // Threads to parse with. 0 for one per hardware thread.
+    
+public:
+    Options();
+    ~Options();
+    
+    int parseArg(string arg);
+    void setLevel(string level);
+    bool isEnabled(string pass);
+    bool isOptimizeForSize();
+    bool isSizeReport();
+    bool isROMWarnOnly();
+    bool isStats();
+    bool isEmitIR();
+    bool isDirectWrite();
+    int getInstrument();
+    int getProfileBase();
+    string getSizeBaseline();
+    bool isRecordBaseline();
+    int getSizeTolerance();
+    int getJobs();
+    string getDescription();
+};
+
+
 /**
  * Parses the VM commands after removing excess whitespace and comments.
  * Stores parsed vm code in a 2D vector<string>, with each element of a command being separated.
  * I.E. output{lineOne{push, this, 10}, etc...}
+ * Large input is split into chunks of whole functions that are parsed on their own threads, then joined in order.
  */
 class Parser
 {
 private:
     const string EMPTY_STR = "";
+    const int MIN_CHUNK_SIZE = 1 << 16; // Smallest chunk worth a thread, in chars.
     
     vector<vector<string>> output;
     vector<vector<string>> parseVMString(string input); 
+    vector<int> getChunkStarts(string* input, int chunks);
     
 public:
     Parser();
     ~Parser();
     
-    void parseInput(string* input);
+    void parseInput(string* input, int jobs);
     vector<vector<string>> getOutput();
     string resolveExcess(string* input);
 };
 
 
+/**
+ * Optimization passes that rewrite the parsed VM commands before they are analyzed and translated.
+ * Passes may add pseudo commands for the Translator, like Parser's "newfile":
+ *  - alias <name> : The next function is also called <name>. Its label is declared with the function's.
+ *  - mulconst <c> : Replaces the top stack value x with x * c, like push constant c; call Math.multiply 2.
+ *  - divconst <c> : Replaces the top stack value x with x / c, like push constant c; call Math.divide 2. c is a power of 2.
+ *  - arrayload : Replaces the top two stack values a, i with *(a+i), and sets that to a+i. Like add; pop pointer 1; push that 0.
+ *  - arraystore : Pops the top two stack values p, x, stores x at *p, and sets that to p and temp 0 to x.
+ *    Like pop temp 0; pop pointer 1; push temp 0; pop that 0.
+ *  - discard : Pops the top stack value, and does nothing with it. Like an if-goto to the next command.
+ */
+class Optimizer
+{
+private:
+    map<string, int> stats; // How many times each pass changed something, for --stats.
+    map<string, string> foldedFunctions; // Functions removed by foldIdenticalFunctions, and the function they alias.
+    
+    // Largest inline multiply/divide, in asm lines, when optimizing for speed and for size (about the size of the call).
+    const int MAX_INLINE_SPEED = 100;
+    const int MAX_INLINE_SIZE = 40;
+    
+    void foldIdenticalFunctions(vector<vector<string>>* input);
+    void reduceMultiplyDivide(vector<vector<string>>* input, bool isOptimizeForSize);
+    void recognizeArrayAccess(vector<vector<string>>* input);
+    void cleanUpControlFlow(vector<vector<string>>* input);
+    bool cleanUpUnit(vector<vector<string>>* unit);
+    string getLabelKey(string labelName);
+    vector<vector<string>> getConstantPush(int value);
+    string normalizeFunction(vector<vector<string>>* input, int start, int end, string fileName);
+    
+public:
+    Optimizer();
+    ~Optimizer();
+    
+    void optimizeInput(vector<vector<string>>* input, Options* options);
+    map<string, string> getFoldedFunctions();
+    string getStats();
+};
+
+
+/**
+ * Whole-program analysis of the parsed VM commands.
+ * Builds a call graph and classifies each function by which segment pointers (this/that) it, or anything it calls, clobbers.
+ * This lets the Translator skip saving pointers in a call frame that the callee can never change.
+ * Functions that can never be called while they are already running get a static frame, at fixed RAM addresses:
+ * {return address, argument base, saved this, saved that, locals...}. Static frames of functions that can
+ * never run at the same time share registers. They are placed at the top of RAM[16-255], under the stack,
+ * while the assembler places static variables from the bottom.
+ * Only a directory is a whole program; For a single .vm file, with or without Sys.init, every function keeps the standard frame.
+ */
+class Analyzer
+{
+private:
+    // The pointers that are always saved in a frame, and the ones that may be skipped.
+    const vector<string> FRAME_POINTERS = {"local", "argument", "this", "that"};
+    // Static frame registers before the locals, in order.
+    const vector<string> STATIC_FRAME_SLOTS = {"return", "argument", "this", "that"};
+    // The registers the assembler can place variables in, and static frames share: RAM[16-255].
+    const int VARIABLE_BASE = 16;
+    const int STACK_BASE = 256;
+    
+    struct FunctionInfo
+    {
+        vector<string> callees; // Names of every function called from this function.
+        bool clobbersThis = false; // True if the function, or anything it calls, may change the this pointer.
+        bool clobbersThat = false; // True if the function, or anything it calls, may change the that pointer.
+        int nLocals = 0;
+        int frameBase = -1; // Address of the static frame, or -1 if the function uses a stack frame.
+    };
+    
+    map<string, FunctionInfo> functions;
+    map<string, string> aliases; // Names declared with "alias", and the function they belong to.
+    map<string, bool> variables; // Every symbol the assembler will place in RAM[16-255].
+    bool isWholeProgram;
+    
+    void propagateClobbers();
+    void placeStaticFrames();
+    bool isRecursive(string funcName);
+    string resolveAlias(string funcName);
+    
+public:
+    Analyzer();
+    ~Analyzer();
+    
+    void analyzeInput(vector<vector<string>> input, bool isWholeProgram);
+    vector<string> getSavedPointers(string funcName);
+    bool isStaticFrame(string funcName);
+    int getStaticFrameAddress(string funcName, string slot, int index);
+};
+
+
+/**
+ * Writes the output file in blocks, so it never has to be held in memory whole.
+ * Blocks are written by a background thread while the next ones are translated, unless it is opened for direct writing.
+ * At most MAX_QUEUED_BLOCKS wait to be written; Handing over another waits for one to be done.
+ */
+class OutputWriter
+{
+private:
+    static const int MAX_QUEUED_BLOCKS = 4;
+    
+    ofstream file;
+    bool isAsync;
+    bool isClosing; // No more blocks are coming.
+    std::thread thread;
+    std::mutex mutex; // Guards blocks and isClosing.
+    std::condition_variable blocksChanged; // Signaled when a block is queued or taken, or when closing.
+    deque<string> blocks; // Blocks waiting to be written, in order.
+    
+    void writeBlocks();
+    
+public:
+    static const int BLOCK_SIZE = 1 << 16; // Output to collect before handing it over, in chars.
+    
+    OutputWriter();
+    ~OutputWriter();
+    
+    int open(string path, bool isAsync);
+    void write(string* block);
+    int close();
+};
+
+
 /**
  * Translates vm code into hack asm code. 
  * Precedes asm translation with a comment of the command in vm.
+ * With an OutputWriter, the output is handed to it every OutputWriter::BLOCK_SIZE chars instead of being kept.
  */
 class Translator
 {
 private:
     // Register numbers for pointers according to the hack vm specification. sp is included for consistency.
     const vector<vector<string>> STACK_BASE_NUMS = {{"sp", "0"}, {"local", "1"}, {"argument", "2"}, {"this", "3"}, {"that", "4"}};
-    string output;
+    string output; // The output not yet handed to writer.
+    OutputWriter* writer; // Where full blocks of output go. May be NULL, to keep the output until one is set.
+    Analyzer* analyzer; // Used to decide which pointers each function's frame has to save. May be NULL.
     string fileName; // Current VM file name.
     int asmLineNum; // Current .asm line number.
     string curFuncName = ""; // Used to create labels within a function, so they are not mixed up with other labels.
+    string curCategory = ""; // The vm command (with its segment for push/pop) the current asm lines belong to.
+    vector<string> counterNames; // What each profiling counter counts. Counter i is at RAM[profileBase + i].
+    int profileBase; // RAM address of the first profiling counter, decided when translation starts.
     int curStaticNum; // The count of static variables.
+    Options* options; // Which passes to run, and whether to prefer size or speed. Never NULL.
+    
+    // A value on the virtual stack: Stack values that have been pushed, but not yet stored at their stack register.
+    enum StackValueKind { CONST_VALUE, D_VALUE, MEM_VALUE };
+    struct StackValue
+    {
+        StackValueKind kind; // A known constant, a value in the D register, or a value already stored at its stack register.
+        int value; // The value of a CONST_VALUE.
+    };
+    
+    // The virtual stack. vStack.at(i) belongs at register *sp + i, the real sp is only moved at basic block boundaries.
+    // At most one value is a D_VALUE.
+    vector<StackValue> vStack;
+    
+    // Asm lines (ROM words) used, by function, vm file, and vm command category:
+    map<string, int> funcSizes;
+    map<string, int> fileSizes;
+    map<string, int> categorySizes;
+    
+    // Ways to address a segment register, and their cost for instruction selection:
+    // {name, asm lines, asm lines per step, executed instructions, executed instructions per step, uses D, whole pop only}.
+    // A pattern that uses D can't be picked while D holds a value; Whole pop patterns are only compared by the pop translation.
+    //  - direct : @<address>, for temp, pointer, static, and local in a function with a static frame.
+    //  - reuse : A=A+1 or A=A-1 per step from the address of the same segment already in A.
+    //  - chain : @<pointer> A=M (index 0) or A=M+1, then A=A+1 per step past index 1.
+    //  - add : @<index> D=A @<pointer> A=D+M.
+    // And whole pops to local, argument, this, or that that don't need a free D for the address:
+    //  - swap : From the real stack. @<index> D=A @<pointer> D=D+M @sp AM=M-1 D=D+M A=D-M M=D-A.
+    //  - swapd : From D. @R13 M=D @<index> D=A @<pointer> D=D+M @R13 D=D+M A=D-M M=D-A.
+    const vector<vector<string>> ACCESS_COSTS = {{"direct", "1", "0", "1", "0", "0", "0"}, {"reuse", "0", "1", "0", "1", "0", "0"},
+        {"chain", "2", "1", "2", "1", "0", "0"}, {"add", "4", "0", "4", "0", "1", "0"},
+        {"swap", "9", "0", "9", "0", "1", "1"}, {"swapd", "10", "0", "10", "0", "0", "1"}};
+    string knownSegment = ""; // The segment whose register A is known to be at, or "" if A is unknown.
+    int knownIndex = 0; // The index into knownSegment A is at.
     
     // ASM code corresponding to vm commands(not \n terminated):
     string getLastTwoVal;
@@ -67,44 +293,117 @@ private:
     string createVMComment(vector<string> vm);
     void translateVMCom(vector<string> vm);
     void translatePopPush(vector<string> vm);
+    void translateSelectedPopPush(vector<string> vm);
+    void translateSelectedPop(string segment, int index);
+    void translateSelectedStoreD(string segment, int index);
+    int selectAccess(string segment, int index, bool canUseD, string* code);
+    int getAccessCost(string pattern, int steps);
     void translateAL(string vm);
     void translateLabel(string labelName, bool isFunc);
     void translateGoTo(vector<string> goToCom, bool isFunc);
     void translateFuncCom(vector<string> funcCom);
+    void translateLocalInit(int nVars);
     void translateCallCom(vector<string> funcCom);
     void translateReturnCom();
+    void translateStaticCall(vector<string> callCom);
+    void translateStaticReturn();
+    bool translateVStackCom(vector<string> vm);
+    void vStackPush(vector<string> vm);
+    void vStackPop(vector<string> vm);
+    void vStackAL(string vm);
+    void vStackIfGoTo(vector<string> goToCom);
+    void translateConstArith(vector<string> vm);
+    void translateArrayAccess(vector<string> vm);
+    void translateConstMultiply(int value);
+    void translateConstDivide(int value);
+    static bool isConstDivideLooped(int value, bool isOptimizeForSize);
+    void vStackPopToD();
+    void vStackLoadD(int slot);
+    void vStackFreeD();
+    void flushVStack(int keep);
+    string getSlotAddress(int slot);
+    string getConstToA(int value);
+    string getConstToD(int value);
+    string getExternalAddress(string segment, string index);
+    bool isDirectSegment(string segment);
+    string getSegmentPointer(string segment);
+    bool isStaticFrame(string funcName);
+    string getStaticFrameAddress(string funcName, string slot, int index);
+    string getLocalLabel(string labelName);
+    void addProfileCounter(string name);
     string getPointer(string input);
+    vector<string> getSavedPointers(string funcName);
+    string getSizeTable(string title, map<string, int>* sizes);
     void initializePremadeASM();
     void addASMOutput(string input);
     
 public:
+    static const int ROM_SIZE = 32768; // Words of hack ROM.
+    static const int MAX_UNROLLED_DIVIDE = 100; // Largest unrolled divide by a constant, in asm lines. Larger ones loop instead.
+    static const int HEAP_BASE = 2048; // First RAM address of the heap.
+    static const int SCREEN_BASE = 16384; // First RAM address of the screen, right after the heap.
+    
+    static int getConstMultiplySize(int value);
+    static int getConstDivideSize(int value, bool isOptimizeForSize);
+    
     Translator();
     ~Translator();
     
+    void setAnalyzer(Analyzer* analyzer);
+    void setOptions(Options* options);
+    void setWriter(OutputWriter* writer);
+    void flushOutput();
+    void addHeader();
     void addInitCode();
     void translateInput(vector<vector<string>> input);
-    string getOutput();
+    int getROMSize();
+    int getFunctionSize(string funcName);
+    string getSizeReport();
+    string getSizeBaseline();
+    string getProfileMap();
+    int getProfileBase();
+    int getProfileEnd();
 };
 
 
 /**
  * Translates vm code at path into HACK asm code.
  * Creates a new .asm file of the same name as path, in the same directory.
+ * path may also be, or hold, .vmir files: The parsed commands of a .vm file, so they can be loaded without lexing or parsing.
+ * The header words are 32 bit little endian:
+ *  - Header: "VMIR", IR_VERSION, symbol count, symbol bytes, command count.
+ *  - Symbol data: Every distinct command element, '\0' terminated, one after another. Symbol i is the i-th one.
+ *  - Commands: The element count, then that many symbol numbers, each a varint (7 bits per byte, low bits first,
+ *    the high bit set on every byte but the last). Most commands take 2 to 4 bytes.
  */
  class VMTranslator 
  {
 private: 
+    static const uint32_t IR_VERSION = 2;
+    static const uint32_t IR_MAX_ELEMENTS = 3;
+    
     string input;
+    vector<string> inputPaths; // The .vm files in input, in order.
     Parser* parser;
+    Optimizer* optimizer;
+    Analyzer* analyzer;
     Translator* translator;
     
     int loadInput(string* path);
+    int loadIR(string* path, vector<vector<string>>* output);
+    int writeIR(string path, vector<vector<string>> commands);
+    static void appendIRWord(string* buffer, uint32_t value);
+    static uint32_t readIRWord(string* buffer, size_t offset);
+    static void appendIRVarint(string* buffer, uint32_t value);
+    static bool readIRVarint(string* buffer, size_t* offset, uint32_t* value);
+    int checkSizeBaseline(Options* options);
+    map<string, int> parseSizeBaseline(string input);
     
 public:
     VMTranslator();
     ~VMTranslator();
     
-    int translate(char* path);
+    int translate(char* path, Options* options);
     static vector<string> getLine(string* input, int start);
     static vector<string> getLine(string* input, int start, char endChar);
     bool isDirectory(string* input);
@@ -1,2 +1,2 @@
-g++ main.cpp VMTranslator/VMTranslator.cpp -o vmtranslator -std=c++11 -static-libgcc -static-libstdc++
+g++ main.cpp VMTranslator/VMTranslator.cpp -o vmtranslator -std=c++11 -pthread -static-libgcc -static-libstdc++
 vmtranslator.exe C:\Users\Night_Blader\Desktop\nand2tetris\projects\07\MemoryAccess\StaticTest\StaticTest.vm
\ No newline at end of file
@@ -1,6 +1,39 @@
 /************************************************************************-
  *  VMTranslator translates .vm files to .asm files according to the HACK computer and VM language specifications.
- *  Usage: vmtranslator <path to .vm file or directory containing .vm files> 
+ *  Usage: vmtranslator [options] <path to .vm/.vmir file or directory containing .vm/.vmir files> 
+ *  Options:
+ *      -O0, -O1, -O2, -Os : Optimization level. -O0 is the plain translation, -O1 (default) the safe optimizations,
+ *                           -O2 all of them, and -Os all of them preferring fewer asm lines over fewer executed instructions.
+ *      -f<pass>, -fno-<pass> : Enable or disable a single optimization pass, whatever level is given.
+ *                              Passes: frames (smaller call frames), locals (cheaper local initialization),
+ *                                      vstack (-O2; keep stack values in D or as constants within a basic block),
+ *                                      fold (share the code of functions with identical bodies),
+ *                                      strength (-O2; inline Math.multiply and Math.divide by constants),
+ *                                      select (pick the cheapest way to address each segment),
+ *                                      arrays (compile Jack array reads and writes as one access each),
+ *                                      jumps (thread jump chains, remove jumps to the next command and unreachable code),
+ *                                      static (-O2; give functions that are never recursive a frame at fixed addresses).
+ *      --size-report : Also write a .size file listing the ROM words used per function, file, and vm command, largest first.
+ *      --rom-warn : Only warn when the output is larger than the 32K word hack ROM, instead of failing and deleting the .asm.
+ *      --stats : Print what the optimization passes changed.
+ *      --emit-ir : Also write a .vmir file next to each .vm file, holding its parsed commands. .vmir files are
+ *                  translated like .vm files without being parsed again; In a directory, a .vmir file is
+ *                  skipped if the .vm file it came from is there too.
+ *      --instrument : Count every function call in RAM, and write a .prof file mapping each counter's address to its function.
+ *      --instrument-labels : Like --instrument, but also count every time a label (I.E. a loop) is reached.
+ *      --profile-base=<address> : Where the counters start in RAM, from 2048 to 16383. By default they end right under the screen.
+ *                                 Either way they are taken from the heap, which shrinks by one word per counter (the .prof file
+ *                                 says which registers); Translation fails if they don't fit in it. The counters rely on
+ *                                 RAM starting zeroed, and nothing else using those registers.
+ *      --size-baseline=<path> : Compare the asm lines used in total and per vm command to the baseline file at path,
+ *                               and fail if any grew past the tolerance, or if the file doesn't exist.
+ *      --record-baseline : Write the current sizes to the --size-baseline file instead of comparing, after an intended change.
+ *                          Needs --size-baseline.
+ *      --size-tolerance=<percent> : How much the sizes may grow past the baseline. The default is 2.
+ *      --direct-write : Write the .asm file on the translating thread. By default it is written in blocks by a background
+ *                       thread while translation goes on.
+ *      --jobs=<count> : How many threads parse large input, split at function boundaries. 0 (default) for one per CPU thread.
+ *                       The output is the same for any count.
  *  Output: A .asm file in the same directory as path with the same name.
  *
  *  Hack VM specifications:
@@ -17,6 +50,8 @@
  *          <this pointer value>
  *          <that pointer value>
  *          <...Local Variables...>
+ *      When translating a whole program (a directory), this and that are only saved if the called function,
+ *      Or anything it calls, can change them (pop pointer). Such frames are smaller, and return restores only what was saved.
  *
  *      The hack architecture separates the RAM into several memory segments:
  *          - "The stack" : This is the primary stack where values are pushed, popped, and have operations done to them. The pointer value is at RAM[0].
@@ -86,27 +121,45 @@
  *  Finished: January 26, 2018
  *  Updates:
  *      - Added function commands. Finished March 18th, 2018.
+ *      - Call frames only save this/that when the callee can clobber them (whole program analysis).
+ *      - Functions that are never recursive get static frames in RAM[16-255], shared between functions that never run together.
  * 
  *  ©2018 C. A. Acred all rights reserved.
  ----------------------------------------------------------*
 */
 
-// Compile: g++ main.cpp VMTranslator/VMTranslator.cpp -o vmtranslator -std=c++11 -static-libgcc -static-libstdc++
-// Debug:   g++ -g main.cpp VMTranslator/VMTranslator.cpp -o vmtranslator -std=c++11 -static-libgcc -static-libstdc++
+// Compile: g++ main.cpp VMTranslator/VMTranslator.cpp -o vmtranslator -std=c++11 -pthread -static-libgcc -static-libstdc++
+// Debug:   g++ -g main.cpp VMTranslator/VMTranslator.cpp -o vmtranslator -std=c++11 -pthread -static-libgcc -static-libstdc++
 
 #include "VMTranslator/VMTranslator.h"
 #include <iostream>
 
 main(int argc, char** argv)
 {
-    if (argc != 2) // Make sure you got a path, and only one path.
+    Options* options = new Options();
+    char* path = NULL;
+    bool isValid = true;
+    for (int i = 1; i < argc; i++)
     {
-        cout << "Invalid usage; Usage: vmtranslator (path to .vm file or dir of .vm files)\n";
+        if (argv[i][0] == '-') // Options start with '-'.
+            isValid = isValid && options->parseArg(argv[i]) == 0;
+        else if (path == NULL)
+            path = argv[i];
+        else
+            isValid = false;
+    }
+    
+    if (options->isRecordBaseline() && options->getSizeBaseline() == "") // There is nowhere to record to.
+        isValid = false;
+    
+    if (!isValid || path == NULL) // Make sure you got a path, and only one path, and that every option is valid.
+    {
+        cout << "Invalid usage; Usage: vmtranslator [-O0|-O1|-O2|-Os] [-f<pass>|-fno-<pass>...] [--size-report] [--rom-warn] [--stats] [--emit-ir] [--instrument|--instrument-labels] [--profile-base=<address>] [--size-baseline=<path>] [--record-baseline] [--size-tolerance=<percent>] [--jobs=<count>] [--direct-write] (path to .vm/.vmir file or dir of .vm/.vmir files)\n";
         return 1;
     }
     
     VMTranslator* vmTranslator = new VMTranslator();
-    int error = vmTranslator->translate(argv[1]);
+    int error = vmTranslator->translate(path, options);
     if (error == 1)
     {
         cout << "Error has occurred!\n";
@@ -0,0 +1,8 @@
+@echo off
+rem Checks that no program in size-corpus translates to more asm lines than its checked in baseline allows.
+rem Pass --record-baseline to record the baselines again after an intended size change.
+set failed=0
+for /d %%p in (size-corpus\*) do (
+    vmtranslator.exe -O2 --size-baseline=%%p.baseline %* %%p || set failed=1
+)
+exit /b %failed%
\ No newline at end of file